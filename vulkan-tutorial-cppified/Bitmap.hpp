@@ -1,27 +1,415 @@
 #pragma once
 #define STB_IMAGE_IMPLEMENTATION
-#define STBI_NO_THREAD_LOCALS
+/*the failure reason is kept per thread, so bitmaps can be decoded concurrently*/
 #include "stb_image.h"
 
+#include "MappedFile.hpp"
+#include "PixelFormat.hpp"
+#include "ThreadPool.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <filesystem>
+#include <future>
+#include <limits>
+#include <span>
+#include <variant>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITMAP_RUNTIME_DISPATCH
+#include <immintrin.h>
+#endif
 
 enum class BitmapPixelFormat 
 {
 	RGBA,
+	RGB,
+	BGRA,
+	/*block compressed, produced by the encoders and never decoded from files*/
+	BC1,
+	BC3,
+	BC7,
 };
 
+constexpr bool
+BitmapPixelFormatIsBlockCompressed(const BitmapPixelFormat format) noexcept
+{
+	return format == BitmapPixelFormat::BC1
+		|| format == BitmapPixelFormat::BC3
+		|| format == BitmapPixelFormat::BC7;
+}
+
+/*bytes of every 4x4 block of a block compressed format*/
+constexpr size_t
+BitmapPixelFormatBytesPerBlock(const BitmapPixelFormat format) noexcept
+{
+	switch (format) {	
+	case BitmapPixelFormat::BC1:
+		return 8;
+	case BitmapPixelFormat::BC3:
+	case BitmapPixelFormat::BC7:
+		return 16;
+	default:
+		break;
+	};
+	return 0;
+}
+
+/*BGRA is loaded as RGBA and swizzled in place afterwards*/
 constexpr uint32_t
 BitmapPixelFormatToSTBIFormat(const BitmapPixelFormat format) noexcept
 {
 	switch (format) {	
 	case BitmapPixelFormat::RGBA:
 		return STBI_rgb_alpha;
+	case BitmapPixelFormat::RGB:
+		return STBI_rgb;
+	case BitmapPixelFormat::BGRA:
+		return STBI_rgb_alpha;
 	default:
 		break;
 	};
 	return STBI_rgb_alpha;
 }
 
+constexpr size_t
+BitmapPixelFormatBytesPerPixel(const BitmapPixelFormat format) noexcept
+{
+	switch (format) {	
+	case BitmapPixelFormat::RGB:
+		return 3;
+	default:
+		break;
+	};
+	return 4;
+}
+
+/**
+ * Scalar reference pixel conversions.
+ * Counts are in pixels, the vectorized kernels below give bit identical
+ * results and src and dst may be the same for the 4 byte to 4 byte kernels.
+ */
+void
+expand_rgb_to_rgba_scalar(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	for (size_t i = 0; i < count; i++) {
+		dst[i * 4 + 0] = src[i * 3 + 0];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 2];
+		dst[i * 4 + 3] = 255;
+	}
+}
+
+void
+swizzle_rgba_bgra_scalar(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	for (size_t i = 0; i < count * 4; i += 4) {
+		const uint8_t r = src[i + 0];
+		const uint8_t b = src[i + 2];
+		dst[i + 0] = b;
+		dst[i + 1] = src[i + 1];
+		dst[i + 2] = r;
+		dst[i + 3] = src[i + 3];
+	}
+}
+
+using ColorLookupTable = std::array<uint32_t, 256>;
+
+/*8bit sRGB encoded channel to 8bit linear channel*/
+[[nodiscard]]
+const ColorLookupTable&
+srgb_to_linear_table() noexcept
+{
+	static const ColorLookupTable table = [] ()
+	{
+		ColorLookupTable decoded{};
+		for (uint32_t i = 0; i < 256; i++) {
+			const double c = i / 255.0;
+			const double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+			decoded[i] = static_cast<uint32_t>(std::lround(linear * 255.0));
+		}
+		return decoded;
+	}();
+	return table;
+}
+
+/*8bit linear channel to 8bit sRGB encoded channel*/
+[[nodiscard]]
+const ColorLookupTable&
+linear_to_srgb_table() noexcept
+{
+	static const ColorLookupTable table = [] ()
+	{
+		ColorLookupTable encoded{};
+		for (uint32_t i = 0; i < 256; i++) {
+			const double c = i / 255.0;
+			const double srgb = c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055;
+			encoded[i] = static_cast<uint32_t>(std::lround(srgb * 255.0));
+		}
+		return encoded;
+	}();
+	return table;
+}
+
+/*the color channels go through the table, alpha is kept as is*/
+void
+lookup_rgb_scalar(const ColorLookupTable& table,
+				  const uint8_t* src,
+				  uint8_t* dst,
+				  const size_t count) noexcept
+{
+	for (size_t i = 0; i < count * 4; i += 4) {
+		dst[i + 0] = static_cast<uint8_t>(table[src[i + 0]]);
+		dst[i + 1] = static_cast<uint8_t>(table[src[i + 1]]);
+		dst[i + 2] = static_cast<uint8_t>(table[src[i + 2]]);
+		dst[i + 3] = src[i + 3];
+	}
+}
+
+void
+srgb_to_linear_scalar(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	lookup_rgb_scalar(srgb_to_linear_table(), src, dst, count);
+}
+
+void
+linear_to_srgb_scalar(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	lookup_rgb_scalar(linear_to_srgb_table(), src, dst, count);
+}
+
+/*every channel, alpha included, is mapped from [0, 255] to a [0, 1] half float*/
+void
+rgba8_to_rgba16f_scalar(const uint8_t* src, uint16_t* dst, const size_t count) noexcept
+{
+	static const std::array<uint16_t, 256> table = [] ()
+	{
+		std::array<uint16_t, 256> halves{};
+		for (uint32_t i = 0; i < 256; i++)
+			halves[i] = float_to_half(static_cast<float>(i) / 255.0f);
+		return halves;
+	}();
+
+	for (size_t i = 0; i < count * 4; i++)
+		dst[i] = table[src[i]];
+}
+
+#if defined(BITMAP_RUNTIME_DISPATCH)
+__attribute__((target("ssse3")))
+void
+expand_rgb_to_rgba_ssse3(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+										  6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+	size_t i = 0;
+	/*each load reads 16 bytes but only uses 12, so stop 6 pixels from the end*/
+	for (; i + 6 <= count; i += 4) {
+		const __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+		const __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), rgba);
+	}
+	expand_rgb_to_rgba_scalar(src + i * 3, dst + i * 4, count - i);
+}
+
+__attribute__((target("avx2")))
+void
+expand_rgb_to_rgba_avx2(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+											 6, 7, 8, -1, 9, 10, 11, -1,
+											 0, 1, 2, -1, 3, 4, 5, -1,
+											 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000));
+	size_t i = 0;
+	/*the two 128bit lanes load 4 pixels each, 12 bytes apart*/
+	for (; i + 10 <= count; i += 8) {
+		const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+		const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3 + 12));
+		const __m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+		const __m256i rgba = _mm256_or_si256(_mm256_shuffle_epi8(rgb, shuffle), alpha);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), rgba);
+	}
+	expand_rgb_to_rgba_scalar(src + i * 3, dst + i * 4, count - i);
+}
+
+__attribute__((target("ssse3")))
+void
+swizzle_rgba_bgra_ssse3(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+										  10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_shuffle_epi8(pixels, shuffle));
+	}
+	swizzle_rgba_bgra_scalar(src + i * 4, dst + i * 4, count - i);
+}
+
+__attribute__((target("avx2")))
+void
+swizzle_rgba_bgra_avx2(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+											 10, 9, 8, 11, 14, 13, 12, 15,
+											 2, 1, 0, 3, 6, 5, 4, 7,
+											 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_shuffle_epi8(pixels, shuffle));
+	}
+	swizzle_rgba_bgra_scalar(src + i * 4, dst + i * 4, count - i);
+}
+
+/**
+ * Table lookup of 4 pixels at a time with 32bit gathers, the gathered
+ * channels are packed back to bytes and the alpha bytes restored.
+ */
+__attribute__((target("avx2")))
+void
+lookup_rgb_avx2(const ColorLookupTable& table,
+				const uint8_t* src,
+				uint8_t* dst,
+				const size_t count) noexcept
+{
+	const int* entries = reinterpret_cast<const int*>(table.data());
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+		const __m256i low = _mm256_i32gather_epi32(entries, _mm256_cvtepu8_epi32(pixels), 4);
+		const __m256i high = _mm256_i32gather_epi32(entries,
+													_mm256_cvtepu8_epi32(_mm_srli_si128(pixels, 8)),
+													4);
+		/*packing works within 128bit lanes, the permute restores the channel order*/
+		const __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high),
+													   _MM_SHUFFLE(3, 1, 2, 0));
+		const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words),
+											   _mm256_extracti128_si256(words, 1));
+		const __m128i result = _mm_or_si128(_mm_andnot_si128(alpha, bytes),
+											_mm_and_si128(alpha, pixels));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), result);
+	}
+	lookup_rgb_scalar(table, src + i * 4, dst + i * 4, count - i);
+}
+
+__attribute__((target("avx2")))
+void
+srgb_to_linear_avx2(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	lookup_rgb_avx2(srgb_to_linear_table(), src, dst, count);
+}
+
+__attribute__((target("avx2")))
+void
+linear_to_srgb_avx2(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	lookup_rgb_avx2(linear_to_srgb_table(), src, dst, count);
+}
+
+/*two pixels at a time, the division and the F16C rounding match float_to_half(i / 255.0f)*/
+__attribute__((target("avx2,f16c")))
+void
+rgba8_to_rgba16f_f16c(const uint8_t* src, uint16_t* dst, const size_t count) noexcept
+{
+	const __m256 full = _mm256_set1_ps(255.0f);
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2) {
+		const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i * 4));
+		const __m256 channels = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), full);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4),
+						 _mm256_cvtps_ph(channels, _MM_FROUND_TO_NEAREST_INT));
+	}
+	rgba8_to_rgba16f_scalar(src + i * 4, dst + i * 4, count - i);
+}
+#endif
+
+/**
+ * The conversion kernels used on this machine, picked once from the cpu
+ * features detected at runtime, so one binary runs everywhere and still
+ * uses the widest instructions available.
+ */
+struct BitmapConversionKernels
+{
+	void (*expand_rgb_to_rgba)(const uint8_t*, uint8_t*, size_t) noexcept;
+	void (*swizzle_rgba_bgra)(const uint8_t*, uint8_t*, size_t) noexcept;
+	void (*srgb_to_linear)(const uint8_t*, uint8_t*, size_t) noexcept;
+	void (*linear_to_srgb)(const uint8_t*, uint8_t*, size_t) noexcept;
+	void (*rgba8_to_rgba16f)(const uint8_t*, uint16_t*, size_t) noexcept;
+};
+
+[[nodiscard]]
+BitmapConversionKernels
+select_bitmap_conversion_kernels() noexcept
+{
+	BitmapConversionKernels kernels{expand_rgb_to_rgba_scalar,
+									swizzle_rgba_bgra_scalar,
+									srgb_to_linear_scalar,
+									linear_to_srgb_scalar,
+									rgba8_to_rgba16f_scalar};
+#if defined(BITMAP_RUNTIME_DISPATCH)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) {
+		kernels.expand_rgb_to_rgba = expand_rgb_to_rgba_ssse3;
+		kernels.swizzle_rgba_bgra = swizzle_rgba_bgra_ssse3;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		kernels.expand_rgb_to_rgba = expand_rgb_to_rgba_avx2;
+		kernels.swizzle_rgba_bgra = swizzle_rgba_bgra_avx2;
+		kernels.srgb_to_linear = srgb_to_linear_avx2;
+		kernels.linear_to_srgb = linear_to_srgb_avx2;
+		if (__builtin_cpu_supports("f16c"))
+			kernels.rgba8_to_rgba16f = rgba8_to_rgba16f_f16c;
+	}
+#endif
+	return kernels;
+}
+
+[[nodiscard]]
+const BitmapConversionKernels&
+bitmap_conversion_kernels() noexcept
+{
+	static const BitmapConversionKernels kernels = select_bitmap_conversion_kernels();
+	return kernels;
+}
+
+/*dst holds count * 4 bytes*/
+void
+expand_rgb_to_rgba(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	bitmap_conversion_kernels().expand_rgb_to_rgba(src, dst, count);
+}
+
+/*swaps the red and blue channels, RGBA to BGRA and back again*/
+void
+swizzle_rgba_bgra(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	bitmap_conversion_kernels().swizzle_rgba_bgra(src, dst, count);
+}
+
+void
+srgb_to_linear(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	bitmap_conversion_kernels().srgb_to_linear(src, dst, count);
+}
+
+void
+linear_to_srgb(const uint8_t* src, uint8_t* dst, const size_t count) noexcept
+{
+	bitmap_conversion_kernels().linear_to_srgb(src, dst, count);
+}
+
+/*dst holds count * 4 half floats*/
+void
+rgba8_to_rgba16f(const uint8_t* src, uint16_t* dst, const size_t count) noexcept
+{
+	bitmap_conversion_kernels().rgba8_to_rgba16f(src, dst, count);
+}
+
 struct LoadedBitmap2D
 {
 	LoadedBitmap2D() = default;
@@ -66,7 +454,7 @@ decltype(auto) operator|(LoadedBitmap2D&& bitmap, F&& f)
 size_t
 LoadedBitmap2D::memory_size() const noexcept
 {
-    return width * height * 4;
+    return size_t(width) * height * BitmapPixelFormatBytesPerPixel(format);
 }
 
 LoadedBitmap2D::~LoadedBitmap2D()
@@ -88,29 +476,95 @@ struct InvalidNativePixels
 {
 };
 
-std::variant<LoadedBitmap2D,
-			 InvalidPath,
-			 InvalidNativePixels,
-			 LoadError>
-load_bitmap(const std::filesystem::path& path, const BitmapPixelFormat format) noexcept
+using LoadBitmapResult = std::variant<LoadedBitmap2D,
+									 InvalidPath,
+									 InvalidNativePixels,
+									 LoadError>;
+
+/**
+ * Decode an encoded image (png, jpg, ...) that is already in memory,
+ * like a file read out of an archive.
+ */
+LoadBitmapResult
+load_bitmap(const std::span<const uint8_t> encoded, const BitmapPixelFormat format) noexcept
 {
-	if (!std::filesystem::exists(path))
-		return InvalidPath{path};
-	
+	if (BitmapPixelFormatIsBlockCompressed(format))
+		return LoadError{"block compressed formats are made with compress_bitmap"};
+	if (encoded.size() > static_cast<size_t>(std::numeric_limits<int>::max()))
+		return LoadError{"encoded image is too large"};
+
 	LoadedBitmap2D bitmap;
 	bitmap.format = format;
-    bitmap.pixels = stbi_load(path.string().c_str(),
-							  &bitmap.width,
-							  &bitmap.height,
-							  &bitmap.channels,
-							  BitmapPixelFormatToSTBIFormat(format));
-	
-    if (!bitmap.pixels)
+	bitmap.pixels = stbi_load_from_memory(encoded.data(),
+										  static_cast<int>(encoded.size()),
+										  &bitmap.width,
+										  &bitmap.height,
+										  &bitmap.channels,
+										  BitmapPixelFormatToSTBIFormat(format));
+
+	if (!bitmap.pixels)
 		return LoadError{stbi_failure_reason()};
 
+	if (format == BitmapPixelFormat::BGRA)
+		swizzle_rgba_bgra(bitmap.pixels, bitmap.pixels, size_t(bitmap.width) * bitmap.height);
+
 	return bitmap;
 }
 
+/**
+ * The file is memory mapped and decoded straight from the page cache.
+ * A missing file is found by the open itself, without a separate lookup.
+ */
+LoadBitmapResult
+load_bitmap(const std::filesystem::path& path, const BitmapPixelFormat format) noexcept
+{
+	auto mapped = map_file(path);
+	if (auto* failed = std::get_if<MapFileError>(&mapped)) {
+		if (failed->error == ENOENT || failed->error == ENOTDIR)
+			return InvalidPath{path};
+		return LoadError{"could not map the file"};
+	}
+
+	return load_bitmap(std::get<MappedFile>(mapped).bytes(), format);
+}
+
+/**
+ * Decode a batch of bitmaps concurrently on the pool, one task per path.
+ * The futures are in the order of the paths and hold the same results as
+ * load_bitmap would.
+ */
+[[nodiscard]]
+std::vector<std::future<LoadBitmapResult>>
+load_bitmaps(ThreadPool& pool,
+			 const std::vector<std::filesystem::path>& paths,
+			 const BitmapPixelFormat format)
+{
+	std::vector<std::future<LoadBitmapResult>> results{};
+	results.reserve(paths.size());
+	for (const auto& path: paths)
+		results.push_back(pool.submit([path, format] () { return load_bitmap(path, format); }));
+	return results;
+}
+
+/**
+ * Decode a batch of bitmaps concurrently, calling on_loaded(index, result)
+ * as soon as each one is done, and return once all of them are.
+ * The calling thread decodes too, and on_loaded may run on several
+ * threads at once.
+ */
+template <typename F>
+void
+load_bitmaps(ThreadPool& pool,
+			 const std::vector<std::filesystem::path>& paths,
+			 const BitmapPixelFormat format,
+			 F&& on_loaded)
+{
+	pool.parallel_for(static_cast<uint32_t>(paths.size()), [&] (const uint32_t i)
+	{
+		on_loaded(size_t{i}, load_bitmap(paths[i], format));
+	});
+}
+
 uint8_t*
 get_pixels(const LoadedBitmap2D& bitmap)
 {
@@ -0,0 +1,371 @@
+#pragma once
+
+#include "Bitmap.hpp"
+#include "MappedFile.hpp"
+#include "MipChain.hpp"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * An on disk cache of decoded bitmaps, so warm starts skip decoding.
+ *
+ * Entries are named by a hash of the source path together with the
+ * requested pixel format and mip filter. An entry records the size,
+ * modification time and a hash of the contents of the source it was made
+ * from. A warm start only compares the size and modification time, the
+ * source is hashed only when they differ, and the entry is rebuilt when
+ * the contents changed as well. Writing the entry for a changed source
+ * replaces the one made from its earlier contents.
+ *
+ * The entry is a single file laid out to be used straight from a mapping:
+ *   BitmapCacheHeader
+ *   BitmapCacheLevel[level_count]
+ *   4 byte pixels of all levels, level 0 first, 16 byte aligned
+ */
+struct BitmapCacheHeader
+{
+	std::array<char, 8> magic;
+	uint32_t version;
+	uint32_t vulkan_format;
+	uint64_t source_hash;
+	uint64_t source_size;
+	int64_t source_mtime;
+	/*0 for a single level, otherwise the MipFilter plus one*/
+	uint32_t mip_filter;
+	uint32_t level_count;
+	uint64_t pixel_offset;
+	uint64_t pixel_count;
+};
+
+struct BitmapCacheLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+};
+
+constexpr std::array<char, 8> bitmap_cache_magic{'B', 'M', 'P', 'C', 'A', 'C', 'H', 'E'};
+constexpr uint32_t bitmap_cache_version = 1;
+
+/**
+ * A decoded bitmap read from the cache.
+ * The pixels point into the mapping, nothing is copied until the pixels
+ * are uploaded. When the entry could not be written or mapped, the pixels
+ * point into the decoded ones instead.
+ */
+struct MappedBitmap2D
+{
+	MappedFile file;
+	std::vector<Pixel8bitRGBA> decoded;
+	vk::Format format;
+	std::vector<MipLevel> levels;
+	const Pixel8bitRGBA* pixels{nullptr};
+	size_t pixel_count{0};
+};
+
+/*a 64bit hash of the bytes, reading 8 bytes at a time*/
+[[nodiscard]]
+uint64_t
+hash_bytes(const std::span<const uint8_t> bytes) noexcept
+{
+	constexpr uint64_t k0 = 0x87c37b91114253d5ull;
+	constexpr uint64_t k1 = 0x4cf5ad432745937full;
+	const auto mix = [] (uint64_t h) noexcept
+	{
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		return h ^ (h >> 33);
+	};
+
+	uint64_t h = 0x9e3779b97f4a7c15ull ^ bytes.size();
+	size_t i = 0;
+	for (; i + 8 <= bytes.size(); i += 8) {
+		uint64_t k;
+		std::memcpy(&k, bytes.data() + i, sizeof(k));
+		h ^= std::rotl(k * k0, 31) * k1;
+		h = std::rotl(h, 27) * 5 + 0x52dce729;
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+	h ^= std::rotl(tail * k0, 31) * k1;
+	return mix(h);
+}
+
+[[nodiscard]]
+uint64_t
+hash_source_path(const std::filesystem::path& source)
+{
+	std::error_code error;
+	auto canonical = std::filesystem::weakly_canonical(source, error);
+	if (error)
+		canonical = std::filesystem::absolute(source);
+	const std::string name = canonical.string();
+	return hash_bytes(std::span(reinterpret_cast<const uint8_t*>(name.data()), name.size()));
+}
+
+/*named <path hash>-<format>-<mip filter>.bitmap*/
+[[nodiscard]]
+std::filesystem::path
+bitmap_cache_entry_path(const std::filesystem::path& cache_directory,
+						const uint64_t path_hash,
+						const BitmapPixelFormat format,
+						const uint32_t mip_filter)
+{
+	char name[64];
+	std::snprintf(name, sizeof(name), "%016llx-%u-%u.bitmap",
+				  static_cast<unsigned long long>(path_hash),
+				  static_cast<uint32_t>(format),
+				  mip_filter);
+	return cache_directory / name;
+}
+
+/*what ties an entry to the source as it is now*/
+enum class BitmapCacheMatch
+{
+	/*size and modification time, without reading the source*/
+	Stat,
+	/*size and contents, for a source that was touched but not changed*/
+	ContentHash,
+};
+
+/**
+ * Map a cache entry and check it against the source it should hold.
+ * Anything that does not match, including a truncated file, is a miss.
+ */
+[[nodiscard]]
+std::optional<MappedBitmap2D>
+map_bitmap_cache_entry(const std::filesystem::path& entry_path,
+					   const BitmapCacheHeader& expected,
+					   const BitmapCacheMatch match)
+{
+	auto mapped = map_file(entry_path);
+	if (!std::holds_alternative<MappedFile>(mapped))
+		return std::nullopt;
+	MappedFile& file = std::get<MappedFile>(mapped);
+
+	BitmapCacheHeader header;
+	if (file.size() < sizeof(header))
+		return std::nullopt;
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	const bool same_source = match == BitmapCacheMatch::Stat
+		? header.source_mtime == expected.source_mtime
+		: header.source_hash == expected.source_hash;
+	const bool matches = header.magic == bitmap_cache_magic
+		&& header.version == bitmap_cache_version
+		&& header.source_size == expected.source_size
+		&& same_source
+		&& header.mip_filter == expected.mip_filter
+		&& header.level_count > 0
+		&& header.pixel_offset % alignof(Pixel8bitRGBA) == 0
+		&& header.pixel_offset >= sizeof(header) + header.level_count * sizeof(BitmapCacheLevel)
+		&& header.pixel_count <= (file.size() - header.pixel_offset) / sizeof(Pixel8bitRGBA);
+	if (!matches || header.pixel_offset > file.size())
+		return std::nullopt;
+
+	MappedBitmap2D bitmap{};
+	bitmap.format = static_cast<vk::Format>(header.vulkan_format);
+	bitmap.levels.reserve(header.level_count);
+	for (uint32_t i = 0; i < header.level_count; i++) {
+		BitmapCacheLevel level;
+		std::memcpy(&level,
+					file.data() + sizeof(header) + i * sizeof(BitmapCacheLevel),
+					sizeof(level));
+		if (level.offset + uint64_t{level.width} * level.height > header.pixel_count)
+			return std::nullopt;
+		bitmap.levels.push_back(MipLevel{CanvasExtent{level.width, level.height}, level.offset});
+	}
+	bitmap.pixels = reinterpret_cast<const Pixel8bitRGBA*>(file.data() + header.pixel_offset);
+	bitmap.pixel_count = header.pixel_count;
+	bitmap.file = std::move(file);
+	return bitmap;
+}
+
+/**
+ * Write a cache entry next to its final name and rename it into place,
+ * so readers never map a partially written entry. The temporary name is
+ * unique to the process and the write, so concurrent writers of the same
+ * entry do not interleave, the last rename wins.
+ */
+[[nodiscard]]
+bool
+write_bitmap_cache_entry(const std::filesystem::path& entry_path,
+						 BitmapCacheHeader header,
+						 const MipChain& chain)
+{
+	header.vulkan_format = static_cast<uint32_t>(chain.format);
+	header.level_count = static_cast<uint32_t>(chain.levels.size());
+	const uint64_t table_end = sizeof(header) + header.level_count * sizeof(BitmapCacheLevel);
+	header.pixel_offset = (table_end + 15) & ~uint64_t{15};
+	header.pixel_count = chain.pixels.size();
+
+	static std::atomic<uint64_t> writes{0};
+	std::filesystem::path temporary = entry_path;
+	temporary += "." + std::to_string(getpid()) + "." + std::to_string(writes++) + ".tmp";
+
+	std::error_code error;
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const auto& level: chain.levels) {
+			const auto stored = BitmapCacheLevel{level.extent.width, level.extent.height, level.offset};
+			out.write(reinterpret_cast<const char*>(&stored), sizeof(stored));
+		}
+		const std::array<char, 16> padding{};
+		out.write(padding.data(), static_cast<std::streamsize>(header.pixel_offset - table_end));
+		out.write(reinterpret_cast<const char*>(chain.pixels.data()),
+				  static_cast<std::streamsize>(chain.pixels.size() * sizeof(Pixel8bitRGBA)));
+		out.close();
+		if (!out) {
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporary, entry_path, error);
+	if (error) {
+		std::filesystem::remove(temporary, error);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Record the current modification time in an entry whose source was
+ * touched without changing, so the next start matches it without hashing.
+ * Best effort, an entry that keeps the old time is only hashed again.
+ */
+void
+refresh_bitmap_cache_entry_mtime(const std::filesystem::path& entry_path, const int64_t source_mtime)
+{
+	std::fstream entry(entry_path, std::ios::binary | std::ios::in | std::ios::out);
+	if (!entry)
+		return;
+	entry.seekp(static_cast<std::streamoff>(offsetof(BitmapCacheHeader, source_mtime)));
+	entry.write(reinterpret_cast<const char*>(&source_mtime), sizeof(source_mtime));
+}
+
+/*the decoded chain itself, for when the cache can not hold it*/
+[[nodiscard]]
+MappedBitmap2D
+uncached_bitmap(MipChain&& chain)
+{
+	MappedBitmap2D bitmap{};
+	bitmap.format = chain.format;
+	bitmap.levels = std::move(chain.levels);
+	bitmap.decoded = std::move(chain.pixels);
+	bitmap.pixels = bitmap.decoded.data();
+	bitmap.pixel_count = bitmap.decoded.size();
+	return bitmap;
+}
+
+using LoadCachedBitmapResult = std::variant<MappedBitmap2D,
+											InvalidPath,
+											InvalidNativePixels,
+											LoadError>;
+
+/**
+ * Load a bitmap through the cache in cache_directory.
+ * A hit maps the cached pixels without decoding, a miss decodes the source,
+ * builds the requested mip chain (or just level 0 without a filter), and
+ * writes the entry before mapping it.
+ * The cache is best effort, when the entry can not be written or mapped
+ * the decoded pixels are returned as they are.
+ * RGB sources are cached expanded to RGBA.
+ */
+LoadCachedBitmapResult
+load_cached_bitmap(const std::filesystem::path& cache_directory,
+				   const std::filesystem::path& source,
+				   const BitmapPixelFormat format,
+				   const std::optional<MipFilter> mip_filter = std::nullopt)
+{
+	std::error_code error;
+	const auto source_size = std::filesystem::file_size(source, error);
+	if (error) {
+		if (error.value() == ENOENT || error.value() == ENOTDIR)
+			return InvalidPath{source};
+		return LoadError{"could not stat the file"};
+	}
+	const auto mtime = std::filesystem::last_write_time(source, error);
+	if (error)
+		return InvalidPath{source};
+
+	BitmapCacheHeader expected{};
+	expected.magic = bitmap_cache_magic;
+	expected.version = bitmap_cache_version;
+	expected.source_size = source_size;
+	expected.source_mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+	expected.mip_filter = mip_filter ? static_cast<uint32_t>(*mip_filter) + 1 : 0;
+
+	const auto entry_path = bitmap_cache_entry_path(cache_directory,
+													hash_source_path(source),
+													format,
+													expected.mip_filter);
+	if (auto cached = map_bitmap_cache_entry(entry_path, expected, BitmapCacheMatch::Stat))
+		return std::move(*cached);
+
+	auto mapped_source = map_file(source);
+	if (auto* failed = std::get_if<MapFileError>(&mapped_source)) {
+		if (failed->error == ENOENT || failed->error == ENOTDIR)
+			return InvalidPath{source};
+		return LoadError{"could not map the file"};
+	}
+	const MappedFile& source_file = std::get<MappedFile>(mapped_source);
+	expected.source_size = source_file.size();
+	expected.source_hash = hash_bytes(source_file.bytes());
+
+	if (auto cached = map_bitmap_cache_entry(entry_path, expected, BitmapCacheMatch::ContentHash)) {
+		refresh_bitmap_cache_entry_mtime(entry_path, expected.source_mtime);
+		return std::move(*cached);
+	}
+
+	auto decoded = load_bitmap(source_file.bytes(), format);
+	if (!std::holds_alternative<LoadedBitmap2D>(decoded)) {
+		if (auto* failed = std::get_if<LoadError>(&decoded))
+			return *failed;
+		return InvalidNativePixels{};
+	}
+	MipChain chain = build_mip_chain(std::get<LoadedBitmap2D>(decoded),
+									 mip_filter.value_or(MipFilter::Box),
+									 mip_filter ? all_mip_levels : 1);
+
+	std::filesystem::create_directories(cache_directory, error);
+	if (!write_bitmap_cache_entry(entry_path, expected, chain))
+		return uncached_bitmap(std::move(chain));
+
+	if (auto cached = map_bitmap_cache_entry(entry_path, expected, BitmapCacheMatch::Stat))
+		return std::move(*cached);
+	return uncached_bitmap(std::move(chain));
+}
+
+/**
+ * Copy level 0 of an RGBA cached bitmap into a canvas to draw on.
+ */
+[[nodiscard]]
+Canvas8bitRGBA
+copy_to_canvas(const MappedBitmap2D& bitmap)
+{
+	if (bitmap.format != PixelFormatRGBA8::vulkan_format)
+		throw std::runtime_error("Only RGBA cached bitmaps can be currently copied to canvas...");
+
+	const CanvasExtent extent = bitmap.levels.front().extent;
+	Canvas8bitRGBA canvas;
+	canvas.extent = extent;
+	canvas.pixels = allocate_canvas_pixels(size_t{extent.width} * extent.height, Pixel8bitRGBA{});
+	std::memcpy(canvas.pixels.data(), bitmap.pixels, canvas.memory_size());
+	return canvas;
+}
@@ -0,0 +1,474 @@
+#pragma once
+
+#include "Bitmap.hpp"
+#include "Canvas.hpp"
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+/**
+ * Block compression of 8bit RGBA pixels into BC1, BC3 and BC7 (mode 6).
+ * Every 4x4 block is encoded on its own: the endpoints are found along the
+ * principal axis of the block colors, and the pixels are projected onto the
+ * quantized endpoints to pick their indices. Blocks past the image edge
+ * repeat the last row and column.
+ *
+ *   BC1: RGB in 8 bytes, opaque
+ *   BC3: BC1 colors plus interpolated alpha in 16 bytes
+ *   BC7: mode 6 only, RGBA with 7bit endpoints, p bits and 4bit indices
+ */
+struct CompressedBitmap2D
+{
+	BitmapPixelFormat format;
+	int width{0};
+	int height{0};
+	std::vector<uint8_t> blocks;
+
+	size_t memory_size() const noexcept { return blocks.size(); }
+};
+
+uint8_t const*
+get_pixels(const CompressedBitmap2D& bitmap)
+{
+	return bitmap.blocks.data();
+}
+
+/*a 4x4 block, one array per channel so 4 pixels fit a vector register*/
+struct BlockPixels
+{
+	alignas(16) float r[16];
+	alignas(16) float g[16];
+	alignas(16) float b[16];
+	alignas(16) float a[16];
+};
+
+using BlockColor = std::array<float, 4>;
+
+[[nodiscard]]
+BlockPixels
+fetch_block(const Pixel8bitRGBA* pixels,
+			const CanvasExtent extent,
+			const uint32_t block_x,
+			const uint32_t block_y) noexcept
+{
+	BlockPixels block;
+	for (uint32_t y = 0; y < 4; y++) {
+		const uint32_t row = std::min(block_y * 4 + y, extent.height - 1);
+		for (uint32_t x = 0; x < 4; x++) {
+			const uint32_t column = std::min(block_x * 4 + x, extent.width - 1);
+			const Pixel8bitRGBA p = pixels[size_t{row} * extent.width + column];
+			block.r[y * 4 + x] = p.r;
+			block.g[y * 4 + x] = p.g;
+			block.b[y * 4 + x] = p.b;
+			block.a[y * 4 + x] = p.a;
+		}
+	}
+	return block;
+}
+
+/**
+ * Endpoints at both ends of the principal axis of the block, found by power
+ * iteration on the covariance. channels is 3 to leave alpha out of it.
+ */
+void
+principal_endpoints(const BlockPixels& block,
+					const size_t channels,
+					BlockColor& e0,
+					BlockColor& e1) noexcept
+{
+	const float* planes[4] = {block.r, block.g, block.b, block.a};
+	BlockColor mean{0.0f, 0.0f, 0.0f, 0.0f};
+	BlockColor low{255.0f, 255.0f, 255.0f, 255.0f};
+	BlockColor high{0.0f, 0.0f, 0.0f, 0.0f};
+	for (size_t c = 0; c < channels; c++) {
+		for (size_t i = 0; i < 16; i++) {
+			mean[c] += planes[c][i];
+			low[c] = std::min(low[c], planes[c][i]);
+			high[c] = std::max(high[c], planes[c][i]);
+		}
+		mean[c] /= 16.0f;
+	}
+
+	float covariance[4][4] = {};
+	for (size_t i = 0; i < 16; i++)
+		for (size_t c = 0; c < channels; c++)
+			for (size_t d = 0; d < channels; d++)
+				covariance[c][d] += (planes[c][i] - mean[c]) * (planes[d][i] - mean[d]);
+
+	BlockColor axis{0.0f, 0.0f, 0.0f, 0.0f};
+	for (size_t c = 0; c < channels; c++)
+		axis[c] = high[c] - low[c];
+	for (int iteration = 0; iteration < 8; iteration++) {
+		BlockColor next{0.0f, 0.0f, 0.0f, 0.0f};
+		float length = 0.0f;
+		for (size_t c = 0; c < channels; c++) {
+			for (size_t d = 0; d < channels; d++)
+				next[c] += covariance[c][d] * axis[d];
+			length = std::max(length, std::abs(next[c]));
+		}
+		if (length == 0.0f)
+			break;
+		for (size_t c = 0; c < channels; c++)
+			axis[c] = next[c] / length;
+	}
+
+	float min_t = 0.0f;
+	float max_t = 0.0f;
+	float axis_length = 0.0f;
+	for (size_t c = 0; c < channels; c++)
+		axis_length += axis[c] * axis[c];
+	if (axis_length > 0.0f) {
+		min_t = std::numeric_limits<float>::max();
+		max_t = std::numeric_limits<float>::lowest();
+		for (size_t i = 0; i < 16; i++) {
+			float t = 0.0f;
+			for (size_t c = 0; c < channels; c++)
+				t += (planes[c][i] - mean[c]) * axis[c];
+			min_t = std::min(min_t, t);
+			max_t = std::max(max_t, t);
+		}
+		min_t /= axis_length;
+		max_t /= axis_length;
+	}
+
+	e0 = BlockColor{0.0f, 0.0f, 0.0f, 0.0f};
+	e1 = BlockColor{0.0f, 0.0f, 0.0f, 0.0f};
+	for (size_t c = 0; c < channels; c++) {
+		e0[c] = std::clamp(mean[c] + axis[c] * min_t, 0.0f, 255.0f);
+		e1[c] = std::clamp(mean[c] + axis[c] * max_t, 0.0f, 255.0f);
+	}
+}
+
+/**
+ * Project every pixel onto the line from e0 to e1 and round it to one of
+ * levels evenly spaced steps, 0 being e0. Channels left at 0 in both
+ * endpoints do not take part.
+ */
+void
+project_block(const BlockPixels& block,
+			  const BlockColor& e0,
+			  const BlockColor& e1,
+			  const uint32_t levels,
+			  uint8_t* steps) noexcept
+{
+	const BlockColor direction{e1[0] - e0[0], e1[1] - e0[1], e1[2] - e0[2], e1[3] - e0[3]};
+	const float length = direction[0] * direction[0] + direction[1] * direction[1]
+		+ direction[2] * direction[2] + direction[3] * direction[3];
+	if (length == 0.0f) {
+		std::fill_n(steps, 16, uint8_t{0});
+		return;
+	}
+	const float scale = static_cast<float>(levels - 1) / length;
+	const float last = static_cast<float>(levels - 1);
+
+#if defined(__SSE2__)
+	for (size_t i = 0; i < 16; i += 4) {
+		__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(block.r + i), _mm_set1_ps(e0[0])),
+							  _mm_set1_ps(direction[0]));
+		t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(block.g + i), _mm_set1_ps(e0[1])),
+									 _mm_set1_ps(direction[1])));
+		t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(block.b + i), _mm_set1_ps(e0[2])),
+									 _mm_set1_ps(direction[2])));
+		t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(block.a + i), _mm_set1_ps(e0[3])),
+									 _mm_set1_ps(direction[3])));
+		t = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(scale)), _mm_set1_ps(0.5f));
+		t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(last));
+		alignas(16) int32_t rounded[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(rounded), _mm_cvttps_epi32(t));
+		for (size_t j = 0; j < 4; j++)
+			steps[i + j] = static_cast<uint8_t>(rounded[j]);
+	}
+#else
+	for (size_t i = 0; i < 16; i++) {
+		float t = (block.r[i] - e0[0]) * direction[0];
+		t = t + (block.g[i] - e0[1]) * direction[1];
+		t = t + (block.b[i] - e0[2]) * direction[2];
+		t = t + (block.a[i] - e0[3]) * direction[3];
+		t = t * scale + 0.5f;
+		steps[i] = static_cast<uint8_t>(std::min(std::max(t, 0.0f), last));
+	}
+#endif
+}
+
+/*mask every channel past channels out of a block, so projections ignore it*/
+[[nodiscard]]
+BlockPixels
+color_channels_only(BlockPixels block) noexcept
+{
+	std::fill_n(block.a, 16, 0.0f);
+	return block;
+}
+
+[[nodiscard]]
+uint16_t
+pack_rgb565(const BlockColor& color) noexcept
+{
+	const auto quantize = [] (const float value, const uint32_t max)
+	{
+		return static_cast<uint32_t>(std::lround(value * max / 255.0f));
+	};
+	return static_cast<uint16_t>((quantize(color[0], 31) << 11)
+								 | (quantize(color[1], 63) << 5)
+								 | quantize(color[2], 31));
+}
+
+[[nodiscard]]
+BlockColor
+unpack_rgb565(const uint16_t color) noexcept
+{
+	const uint32_t r = (color >> 11) & 31;
+	const uint32_t g = (color >> 5) & 63;
+	const uint32_t b = color & 31;
+	return BlockColor{static_cast<float>((r << 3) | (r >> 2)),
+		              static_cast<float>((g << 2) | (g >> 4)),
+		              static_cast<float>((b << 3) | (b >> 2)),
+		              0.0f};
+}
+
+/*BC1 color block, always in the opaque 4 color mode*/
+void
+encode_bc1_block(const BlockPixels& block, uint8_t* out) noexcept
+{
+	const BlockPixels colors = color_channels_only(block);
+	BlockColor e0, e1;
+	principal_endpoints(colors, 3, e0, e1);
+
+	uint16_t c0 = pack_rgb565(e0);
+	uint16_t c1 = pack_rgb565(e1);
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	uint32_t indices = 0;
+	if (c0 != c1) {
+		uint8_t steps[16];
+		project_block(colors, unpack_rgb565(c0), unpack_rgb565(c1), 4, steps);
+		/*steps run from c0 to c1, the palette order is c0, c1, 2/3 c0, 1/3 c0*/
+		constexpr uint32_t palette_index[4] = {0, 2, 3, 1};
+		for (size_t i = 0; i < 16; i++)
+			indices |= palette_index[steps[i]] << (2 * i);
+	}
+
+	out[0] = static_cast<uint8_t>(c0 & 0xff);
+	out[1] = static_cast<uint8_t>(c0 >> 8);
+	out[2] = static_cast<uint8_t>(c1 & 0xff);
+	out[3] = static_cast<uint8_t>(c1 >> 8);
+	for (size_t i = 0; i < 4; i++)
+		out[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+/*BC3 alpha block, always in the 8 value mode*/
+void
+encode_bc3_alpha_block(const BlockPixels& block, uint8_t* out) noexcept
+{
+	float low = 255.0f;
+	float high = 0.0f;
+	for (size_t i = 0; i < 16; i++) {
+		low = std::min(low, block.a[i]);
+		high = std::max(high, block.a[i]);
+	}
+	const auto a0 = static_cast<uint8_t>(high);
+	const auto a1 = static_cast<uint8_t>(low);
+
+	uint64_t indices = 0;
+	if (a0 != a1) {
+		BlockPixels alpha{};
+		std::copy_n(block.a, 16, alpha.a);
+		uint8_t steps[16];
+		project_block(alpha,
+					  BlockColor{0.0f, 0.0f, 0.0f, static_cast<float>(a0)},
+					  BlockColor{0.0f, 0.0f, 0.0f, static_cast<float>(a1)},
+					  8,
+					  steps);
+		/*steps run from a0 to a1, the palette order is a0, a1, then the 6 in between*/
+		constexpr uint64_t palette_index[8] = {0, 2, 3, 4, 5, 6, 7, 1};
+		for (size_t i = 0; i < 16; i++)
+			indices |= palette_index[steps[i]] << (3 * i);
+	}
+
+	out[0] = a0;
+	out[1] = a1;
+	for (size_t i = 0; i < 6; i++)
+		out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+void
+encode_bc3_block(const BlockPixels& block, uint8_t* out) noexcept
+{
+	encode_bc3_alpha_block(block, out);
+	encode_bc1_block(block, out + 8);
+}
+
+/*writes bit fields into a 128bit block, least significant bit first*/
+struct BlockBitWriter
+{
+	uint8_t* out;
+	uint32_t position{0};
+
+	void put(const uint32_t value, const uint32_t bits) noexcept
+	{
+		for (uint32_t i = 0; i < bits; i++, position++)
+			if ((value >> i) & 1)
+				out[position / 8] |= static_cast<uint8_t>(1u << (position % 8));
+	}
+};
+
+/**
+ * Quantize an 8bit endpoint to 7bit channels sharing one low p bit,
+ * picking the p bit that lands closest.
+ */
+void
+quantize_bc7_endpoint(const BlockColor& color, uint32_t (&channels)[4], uint32_t& p_bit) noexcept
+{
+	float best_error = std::numeric_limits<float>::max();
+	for (uint32_t p = 0; p < 2; p++) {
+		uint32_t quantized[4];
+		float error = 0.0f;
+		for (size_t c = 0; c < 4; c++) {
+			const float q = std::clamp(std::round((color[c] - p) / 2.0f), 0.0f, 127.0f);
+			quantized[c] = static_cast<uint32_t>(q);
+			const float expanded = static_cast<float>((quantized[c] << 1) | p);
+			error += (expanded - color[c]) * (expanded - color[c]);
+		}
+		if (error < best_error) {
+			best_error = error;
+			p_bit = p;
+			std::copy_n(quantized, 4, channels);
+		}
+	}
+}
+
+void
+encode_bc7_block(const BlockPixels& block, uint8_t* out) noexcept
+{
+	BlockColor e0, e1;
+	principal_endpoints(block, 4, e0, e1);
+
+	uint32_t q0[4], q1[4], p0, p1;
+	quantize_bc7_endpoint(e0, q0, p0);
+	quantize_bc7_endpoint(e1, q1, p1);
+	const auto expand = [] (const uint32_t (&q)[4], const uint32_t p)
+	{
+		return BlockColor{static_cast<float>((q[0] << 1) | p), static_cast<float>((q[1] << 1) | p),
+			              static_cast<float>((q[2] << 1) | p), static_cast<float>((q[3] << 1) | p)};
+	};
+
+	uint8_t steps[16];
+	project_block(block, expand(q0, p0), expand(q1, p1), 16, steps);
+
+	/*the top bit of the first index is implied zero, swap the endpoints to keep it so*/
+	if (steps[0] >= 8) {
+		std::swap(q0, q1);
+		std::swap(p0, p1);
+		for (auto& step: steps)
+			step = static_cast<uint8_t>(15 - step);
+	}
+
+	std::fill_n(out, 16, uint8_t{0});
+	BlockBitWriter writer{out};
+	writer.put(1u << 6, 7);
+	for (size_t c = 0; c < 4; c++) {
+		writer.put(q0[c], 7);
+		writer.put(q1[c], 7);
+	}
+	writer.put(p0, 1);
+	writer.put(p1, 1);
+	writer.put(steps[0], 3);
+	for (size_t i = 1; i < 16; i++)
+		writer.put(steps[i], 4);
+}
+
+/**
+ * Encode all blocks, the rows of blocks are split across the canvas thread pool.
+ */
+[[nodiscard]]
+std::vector<uint8_t>
+encode_blocks(const Pixel8bitRGBA* pixels,
+			  const CanvasExtent extent,
+			  const BitmapPixelFormat format)
+{
+	const size_t block_bytes = BitmapPixelFormatBytesPerBlock(format);
+	const uint32_t blocks_x = (extent.width + 3) / 4;
+	const uint32_t blocks_y = (extent.height + 3) / 4;
+	std::vector<uint8_t> blocks(size_t{blocks_x} * blocks_y * block_bytes);
+
+	canvas_thread_pool().parallel_for(blocks_y, [&] (const uint32_t block_y)
+	{
+		uint8_t* out = blocks.data() + size_t{block_y} * blocks_x * block_bytes;
+		for (uint32_t block_x = 0; block_x < blocks_x; block_x++, out += block_bytes) {
+			const BlockPixels block = fetch_block(pixels, extent, block_x, block_y);
+			switch (format) {
+			case BitmapPixelFormat::BC1:
+				encode_bc1_block(block, out);
+				break;
+			case BitmapPixelFormat::BC3:
+				encode_bc3_block(block, out);
+				break;
+			case BitmapPixelFormat::BC7:
+				encode_bc7_block(block, out);
+				break;
+			default:
+				break;
+			}
+		}
+	});
+	return blocks;
+}
+
+[[nodiscard]]
+CompressedBitmap2D
+compress_bitmap(const Canvas8bitRGBA& canvas, const BitmapPixelFormat format)
+{
+	if (!BitmapPixelFormatIsBlockCompressed(format))
+		throw std::runtime_error("Can only compress to a block compressed format...");
+	if (canvas.extent.width == 0 || canvas.extent.height == 0)
+		throw std::runtime_error("Can not compress an empty canvas...");
+
+	CompressedBitmap2D compressed{};
+	compressed.format = format;
+	compressed.width = static_cast<int>(canvas.extent.width);
+	compressed.height = static_cast<int>(canvas.extent.height);
+	compressed.blocks = encode_blocks(canvas.pixels.data(), canvas.extent, format);
+	return compressed;
+}
+
+/*RGB and BGRA bitmaps are converted to RGBA before encoding*/
+[[nodiscard]]
+CompressedBitmap2D
+compress_bitmap(const LoadedBitmap2D& bitmap, const BitmapPixelFormat format)
+{
+	if (!BitmapPixelFormatIsBlockCompressed(format))
+		throw std::runtime_error("Can only compress to a block compressed format...");
+	if (bitmap.width <= 0 || bitmap.height <= 0)
+		throw std::runtime_error("Can not compress an empty bitmap...");
+
+	const CanvasExtent extent = get_extent(bitmap);
+	const size_t count = size_t{extent.width} * extent.height;
+	std::vector<Pixel8bitRGBA> converted{};
+	const Pixel8bitRGBA* pixels = reinterpret_cast<const Pixel8bitRGBA*>(bitmap.pixels);
+	if (bitmap.format != BitmapPixelFormat::RGBA) {
+		converted.resize(count);
+		auto* dst = reinterpret_cast<uint8_t*>(converted.data());
+		if (bitmap.format == BitmapPixelFormat::RGB)
+			expand_rgb_to_rgba(bitmap.pixels, dst, count);
+		else
+			swizzle_rgba_bgra(bitmap.pixels, dst, count);
+		pixels = converted.data();
+	}
+
+	CompressedBitmap2D compressed{};
+	compressed.format = format;
+	compressed.width = bitmap.width;
+	compressed.height = bitmap.height;
+	compressed.blocks = encode_blocks(pixels, extent, format);
+	return compressed;
+}
+
+decltype(auto)
+compress_bitmap(const BitmapPixelFormat format)
+{
+	return [=] (const auto& image)
+	{
+		return compress_bitmap(image, format);
+	};
+}
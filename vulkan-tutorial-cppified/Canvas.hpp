@@ -1,14 +1,22 @@
 #pragma once
 
 #include "Bitmap.hpp"
+#include "PixelFormat.hpp"
+#include "PixelPool.hpp"
+#include "ThreadPool.hpp"
 
-struct Pixel8bitRGBA
-{
-	uint8_t r;
-	uint8_t g;
-	uint8_t b;
-	uint8_t a;
-};
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 struct CanvasOffset
 {
@@ -22,175 +30,740 @@ struct CanvasExtent
 	uint32_t height;
 };
 
-struct Canvas8bitRGBA
+struct CanvasRect
+{
+	CanvasOffset offset;
+	CanvasExtent extent;
+};
+
+/**
+ * Owning pixel storage of a canvas.
+ * The memory is either allocated for the canvas, or adopted from another
+ * owner (like an stb_image allocation) together with the function that
+ * knows how to release it, so no pixels have to be copied.
+ */
+template <typename Pixel>
+class CanvasPixels
+{
+public:
+	using Release = void(*)(Pixel* pixels, size_t count);
+
+	CanvasPixels() = default;
+	CanvasPixels(Pixel* pixels, const size_t count, Release release) noexcept;
+	~CanvasPixels();
+	CanvasPixels(const CanvasPixels&) = delete;
+	CanvasPixels& operator=(const CanvasPixels&) = delete;
+	CanvasPixels(CanvasPixels&& rhs) noexcept;
+	CanvasPixels& operator=(CanvasPixels&& rhs) noexcept;
+
+	Pixel* data() noexcept { return pixels_; }
+	Pixel const* data() const noexcept { return pixels_; }
+	size_t size() const noexcept { return count_; }
+
+	Pixel& operator[](const size_t i) noexcept { return pixels_[i]; }
+	const Pixel& operator[](const size_t i) const noexcept { return pixels_[i]; }
+
+	Pixel* begin() noexcept { return pixels_; }
+	Pixel* end() noexcept { return pixels_ + count_; }
+	Pixel const* begin() const noexcept { return pixels_; }
+	Pixel const* end() const noexcept { return pixels_ + count_; }
+
+private:
+	Pixel* pixels_{nullptr};
+	size_t count_{0};
+	Release release_{nullptr};
+};
+
+template <typename Pixel>
+CanvasPixels<Pixel>::CanvasPixels(Pixel* pixels, const size_t count, Release release) noexcept
+	: pixels_(pixels)
+	, count_(count)
+	, release_(release)
 {
-	Canvas8bitRGBA() = default;
-	~Canvas8bitRGBA() = default;
-	Canvas8bitRGBA(const Canvas8bitRGBA&) = delete;
-	Canvas8bitRGBA& operator=(const Canvas8bitRGBA&) = delete;
-	Canvas8bitRGBA(Canvas8bitRGBA&& rhs);
-	Canvas8bitRGBA& operator=(Canvas8bitRGBA&& rhs);
+}
+
+template <typename Pixel>
+CanvasPixels<Pixel>::~CanvasPixels()
+{
+	if (pixels_ != nullptr && release_ != nullptr)
+		release_(pixels_, count_);
+}
+
+template <typename Pixel>
+CanvasPixels<Pixel>::CanvasPixels(CanvasPixels&& rhs) noexcept
+{
+	std::swap(pixels_, rhs.pixels_);
+	std::swap(count_, rhs.count_);
+	std::swap(release_, rhs.release_);
+}
+
+template <typename Pixel>
+CanvasPixels<Pixel>& CanvasPixels<Pixel>::operator=(CanvasPixels&& rhs) noexcept
+{
+	std::swap(pixels_, rhs.pixels_);
+	std::swap(count_, rhs.count_);
+	std::swap(release_, rhs.release_);
+	return *this;
+}
+
+/*Released canvas memory kept around for reuse is capped at this many bytes*/
+constexpr size_t canvas_pixel_pool_default_limit = size_t{256} << 20;
+
+/**
+ * The pool every allocated canvas draws its pixels from.
+ * It is never destroyed, so canvases living in statics can still release
+ * their pixels into it at exit.
+ */
+PixelPool&
+canvas_pixel_pool()
+{
+	static PixelPool* pool = new PixelPool(canvas_pixel_pool_default_limit);
+	return *pool;
+}
+
+template <typename Pixel>
+[[nodiscard]]
+CanvasPixels<Pixel>
+allocate_canvas_pixels(const size_t count, const Pixel color)
+{
+	static_assert(std::is_trivially_copyable_v<Pixel> && std::is_trivially_destructible_v<Pixel>);
+	auto release = [] (Pixel* pixels, size_t count)
+	{
+		canvas_pixel_pool().release(pixels, count * sizeof(Pixel));
+	};
+	auto* memory = static_cast<Pixel*>(canvas_pixel_pool().allocate(count * sizeof(Pixel)));
+	CanvasPixels<Pixel> storage(memory, count, release);
+	std::fill(storage.begin(), storage.end(), color);
+	return storage;
+}
+
+/**
+ * Take ownership of an stb_image allocation that already holds tightly
+ * packed 8bit RGBA pixels, it is released with stbi_image_free.
+ */
+[[nodiscard]]
+CanvasPixels<Pixel8bitRGBA>
+adopt_stbi_pixels(stbi_uc* pixels, const size_t count) noexcept
+{
+	static_assert(sizeof(Pixel8bitRGBA) == 4 && alignof(Pixel8bitRGBA) == 1);
+	auto release = [] (Pixel8bitRGBA* pixels, size_t) { stbi_image_free(pixels); };
+	return CanvasPixels<Pixel8bitRGBA>(reinterpret_cast<Pixel8bitRGBA*>(pixels), count, release);
+}
+
+/**
+ * A canvas of pixels in a compile time pixel format.
+ * The format decides the pixel storage and the vulkan format it is
+ * uploaded as, so masks and height maps only pay for the channels they use.
+ */
+template <PixelFormat Format>
+struct Canvas
+{
+	using Pixel = typename Format::Pixel;
+
+	Canvas() = default;
+	~Canvas() = default;
+	Canvas(const Canvas&) = delete;
+	Canvas& operator=(const Canvas&) = delete;
+	Canvas(Canvas&& rhs);
+	Canvas& operator=(Canvas&& rhs);
 
 	size_t memory_size() const noexcept;
 
-	std::optional<std::reference_wrapper<Pixel8bitRGBA>>
+	std::optional<std::reference_wrapper<Pixel>>
 	at(const CanvasOffset offset) noexcept;
 
-	std::optional<std::reference_wrapper<Pixel8bitRGBA>>
+	std::optional<std::reference_wrapper<Pixel>>
 	at(const uint32_t x, const uint32_t y) noexcept;
 
 	CanvasExtent extent{0, 0};
-	std::vector<Pixel8bitRGBA> pixels{};
+	CanvasPixels<Pixel> pixels{};
+	/*regions written by draw ops since the damage was last cleared*/
+	std::vector<CanvasRect> damage{};
 };
 
-Canvas8bitRGBA::Canvas8bitRGBA(Canvas8bitRGBA&& rhs) 
+using Canvas8bitR = Canvas<PixelFormatR8>;
+using Canvas8bitRG = Canvas<PixelFormatRG8>;
+using Canvas8bitRGBA = Canvas<PixelFormatRGBA8>;
+using Canvas8bitBGRA = Canvas<PixelFormatBGRA8>;
+using Canvas16bitFloatRGBA = Canvas<PixelFormatRGBA16F>;
+
+template <PixelFormat Format>
+Canvas<Format>::Canvas(Canvas&& rhs)
 {
 	std::swap(extent, rhs.extent);
 	std::swap(pixels, rhs.pixels);
+	std::swap(damage, rhs.damage);
 }
 
-Canvas8bitRGBA& Canvas8bitRGBA::operator=(Canvas8bitRGBA&& rhs) 
+template <PixelFormat Format>
+Canvas<Format>& Canvas<Format>::operator=(Canvas&& rhs)
 {
 	std::swap(extent, rhs.extent);
 	std::swap(pixels, rhs.pixels);
+	std::swap(damage, rhs.damage);
 	return *this;
 }
 
+template <PixelFormat Format>
 size_t
-Canvas8bitRGBA::memory_size() const noexcept
+Canvas<Format>::memory_size() const noexcept
 {
-    return extent.width * extent.height * sizeof(decltype(pixels)::value_type);
+    return size_t{extent.width} * extent.height * sizeof(Pixel);
 }
 
-std::optional<std::reference_wrapper<Pixel8bitRGBA>>
-Canvas8bitRGBA::at(const CanvasOffset offset) noexcept
+template <PixelFormat Format>
+std::optional<std::reference_wrapper<typename Format::Pixel>>
+Canvas<Format>::at(const CanvasOffset offset) noexcept
 {
 	if (offset.x < extent.width && offset.y < extent.height) {
-		const auto i = offset.y * extent.width + offset.x;
-		return pixels.at(i);
+		const auto i = size_t{offset.y} * extent.width + offset.x;
+		return pixels[i];
 	}
 
 	return std::nullopt;
 }
 
-std::optional<std::reference_wrapper<Pixel8bitRGBA>>
-Canvas8bitRGBA::at(const uint32_t x, const uint32_t y) noexcept
+template <PixelFormat Format>
+std::optional<std::reference_wrapper<typename Format::Pixel>>
+Canvas<Format>::at(const uint32_t x, const uint32_t y) noexcept
 {
 	return at(CanvasOffset{x, y});
 }
 
+template <PixelFormat Format>
 uint8_t*
-get_pixels(Canvas8bitRGBA& canvas)
+get_pixels(Canvas<Format>& canvas)
 {
 	return reinterpret_cast<uint8_t*>(canvas.pixels.data());
 }
 
+template <PixelFormat Format>
 uint8_t const*
-get_pixels(const Canvas8bitRGBA& canvas)
+get_pixels(const Canvas<Format>& canvas)
 {
 	return reinterpret_cast<uint8_t const*>(canvas.pixels.data());
 }
 
+/**
+ * A non owning window into canvas pixels.
+ * Rows are stride pixels apart, so a view of a sub rectangle points straight
+ * into the pixels it was taken from and nothing is copied. Views of const
+ * pixels are read only.
+ * Views do not track damage, the canvas ops mark what they wrote through
+ * a view on the canvas that owns the pixels.
+ */
+template <typename Pixel>
+struct CanvasView
+{
+	/*unchecked, x and y must be inside the extent*/
+	Pixel& at(const uint32_t x, const uint32_t y) const noexcept;
+	std::span<Pixel> row(const uint32_t y) const noexcept;
+	bool empty() const noexcept;
+
+	operator CanvasView<const Pixel>() const noexcept requires (!std::is_const_v<Pixel>);
+
+	Pixel* pixels{nullptr};
+	CanvasExtent extent{0, 0};
+	/*pixels from the start of one row to the start of the next*/
+	size_t stride{0};
+};
+
+using CanvasView8bitR = CanvasView<Pixel8bitR>;
+using CanvasView8bitRG = CanvasView<Pixel8bitRG>;
+using CanvasView8bitRGBA = CanvasView<Pixel8bitRGBA>;
+using CanvasView8bitBGRA = CanvasView<Pixel8bitBGRA>;
+using CanvasView16bitFloatRGBA = CanvasView<Pixel16bitFloatRGBA>;
+
+template <typename T>
+constexpr bool is_canvas_view_v = false;
+
+template <typename Pixel>
+constexpr bool is_canvas_view_v<CanvasView<Pixel>> = true;
+
+/**
+ * What the curried draw ops accept: a canvas only as an rvalue, as its
+ * pixels are moved down the pipeline, and a view in any way, as it is
+ * copied. An lvalue canvas has to be moved in explicitly.
+ */
+template <typename T>
+concept CanvasPipelineArgument = !std::is_lvalue_reference_v<T>
+	|| is_canvas_view_v<std::remove_cvref_t<T>>;
+
+template <typename Pixel>
+Pixel&
+CanvasView<Pixel>::at(const uint32_t x, const uint32_t y) const noexcept
+{
+	return pixels[size_t{y} * stride + x];
+}
+
+template <typename Pixel>
+std::span<Pixel>
+CanvasView<Pixel>::row(const uint32_t y) const noexcept
+{
+	return std::span<Pixel>(pixels + size_t{y} * stride, extent.width);
+}
+
+template <typename Pixel>
+bool
+CanvasView<Pixel>::empty() const noexcept
+{
+	return extent.width == 0 || extent.height == 0;
+}
+
+template <typename Pixel>
+CanvasView<Pixel>::operator CanvasView<const Pixel>() const noexcept requires (!std::is_const_v<Pixel>)
+{
+	return CanvasView<const Pixel>{pixels, extent, stride};
+}
+
+template <PixelFormat Format>
 [[nodiscard]]
-Canvas8bitRGBA
-create_canvas(const Pixel8bitRGBA color,
+CanvasView<typename Format::Pixel>
+as_view(Canvas<Format>& canvas) noexcept
+{
+	return CanvasView<typename Format::Pixel>{canvas.pixels.data(), canvas.extent, canvas.extent.width};
+}
+
+template <PixelFormat Format>
+[[nodiscard]]
+CanvasView<const typename Format::Pixel>
+as_view(const Canvas<Format>& canvas) noexcept
+{
+	return CanvasView<const typename Format::Pixel>{canvas.pixels.data(), canvas.extent, canvas.extent.width};
+}
+
+/**
+ * The canvas format follows from the fill color, so
+ * create_canvas(Pixel8bitR{0}, extent) gives a single channel canvas.
+ */
+template <typename Pixel>
+[[nodiscard]]
+Canvas<PixelFormatOf_t<Pixel>>
+create_canvas(const Pixel color,
 			  const CanvasExtent extent)
 {
-	Canvas8bitRGBA canvas{};
+	Canvas<PixelFormatOf_t<Pixel>> canvas{};
 	canvas.extent = extent;
-	canvas.pixels.resize(extent.width * extent.height, color);
+	canvas.pixels = allocate_canvas_pixels(size_t{extent.width} * extent.height, color);
 	return canvas;
 }
 
+template <PixelFormat Format>
+[[nodiscard]]
+CanvasExtent
+get_extent(const Canvas<Format>& canvas) noexcept
+{
+	return canvas.extent;
+}
+
+template <typename Pixel>
+[[nodiscard]]
+CanvasExtent
+get_extent(const CanvasView<Pixel>& view) noexcept
+{
+	return view.extent;
+}
+
+[[nodiscard]]
+CanvasExtent
+get_extent(const LoadedBitmap2D& bitmap) noexcept
+{
+	return CanvasExtent{static_cast<uint32_t>(bitmap.width),
+		                static_cast<uint32_t>(bitmap.height)};
+}
+
+[[nodiscard]]
+std::optional<CanvasRect>
+intersect_rectangles(const CanvasRect a, const CanvasRect b) noexcept
+{
+	const uint64_t start_x = std::max(a.offset.x, b.offset.x);
+	const uint64_t start_y = std::max(a.offset.y, b.offset.y);
+	const uint64_t end_x = std::min(uint64_t{a.offset.x} + a.extent.width,
+									uint64_t{b.offset.x} + b.extent.width);
+	const uint64_t end_y = std::min(uint64_t{a.offset.y} + a.extent.height,
+									uint64_t{b.offset.y} + b.extent.height);
+	if (end_x <= start_x || end_y <= start_y)
+		return std::nullopt;
+
+	return CanvasRect{CanvasOffset{static_cast<uint32_t>(start_x),
+								   static_cast<uint32_t>(start_y)},
+					  CanvasExtent{static_cast<uint32_t>(end_x - start_x),
+								   static_cast<uint32_t>(end_y - start_y)}};
+}
+
+/**
+ * Clip a rectangle against the canvas bounds once, so the fill kernels
+ * can run without any per pixel bounds checking.
+ */
+[[nodiscard]]
+std::optional<CanvasRect>
+clip_rectangle(const CanvasOffset offset,
+			   const CanvasExtent extent,
+			   const CanvasExtent bounds) noexcept
+{
+	return intersect_rectangles(CanvasRect{offset, extent},
+								CanvasRect{CanvasOffset{0, 0}, bounds});
+}
+
+/**
+ * The part of a view inside rect, with rect relative to the view.
+ * Outside of the view the subview is empty.
+ */
+template <typename Pixel>
+[[nodiscard]]
+CanvasView<Pixel>
+subview(const CanvasView<Pixel> view, const CanvasRect rect) noexcept
+{
+	const auto clipped = clip_rectangle(rect.offset, rect.extent, view.extent);
+	if (!clipped)
+		return CanvasView<Pixel>{view.pixels, CanvasExtent{0, 0}, view.stride};
+
+	return CanvasView<Pixel>{&view.at(clipped->offset.x, clipped->offset.y),
+							 clipped->extent,
+							 view.stride};
+}
+
+[[nodiscard]]
+CanvasRect
+bounding_rectangle(const CanvasRect a, const CanvasRect b) noexcept
+{
+	const uint32_t start_x = std::min(a.offset.x, b.offset.x);
+	const uint32_t start_y = std::min(a.offset.y, b.offset.y);
+	const uint32_t end_x = std::max(a.offset.x + a.extent.width, b.offset.x + b.extent.width);
+	const uint32_t end_y = std::max(a.offset.y + a.extent.height, b.offset.y + b.extent.height);
+	return CanvasRect{CanvasOffset{start_x, start_y},
+					  CanvasExtent{end_x - start_x, end_y - start_y}};
+}
+
+/*More damaged rectangles than this are collapsed into their bounding box*/
+constexpr size_t max_canvas_damage_rects = 16;
+
+/**
+ * Record that a clipped region of the canvas has been written.
+ * Overlapping rectangles are merged into their bounding box, so the damage
+ * list stays short and uploads never send the same pixel twice.
+ * Writes through at() or pixels are not tracked and must be marked manually.
+ */
+template <PixelFormat Format>
+void
+mark_damaged(Canvas<Format>& canvas, CanvasRect rect)
+{
+	for (size_t i = 0; i < canvas.damage.size();) {
+		if (intersect_rectangles(canvas.damage[i], rect)) {
+			rect = bounding_rectangle(canvas.damage[i], rect);
+			canvas.damage.erase(canvas.damage.begin() + i);
+			i = 0;
+			continue;
+		}
+		i++;
+	}
+	canvas.damage.push_back(rect);
+
+	if (canvas.damage.size() > max_canvas_damage_rects) {
+		CanvasRect bounds = canvas.damage.front();
+		for (const auto& damaged: canvas.damage)
+			bounds = bounding_rectangle(bounds, damaged);
+		canvas.damage = {bounds};
+	}
+}
+
+template <PixelFormat Format>
+void
+clear_damage(Canvas<Format>& canvas) noexcept
+{
+	canvas.damage.clear();
+}
+
+/**
+ * Fill a contiguous row span with a single color.
+ * 32-bit pixels are splatted as a pattern and stored 8 (AVX2) or 4 (SSE2)
+ * pixels at a time, with a scalar loop for the remaining tail. Other pixel
+ * sizes are left to the compiler.
+ */
+template <typename Pixel>
+void
+fill_span(Pixel* dst, const size_t count, const Pixel color) noexcept
+{
+	if constexpr (sizeof(Pixel) == sizeof(uint32_t)) {
+		[[maybe_unused]] uint32_t pattern;
+		std::memcpy(&pattern, &color, sizeof(pattern));
+
+		size_t i = 0;
+#if defined(__AVX2__)
+		const __m256i pattern8 = _mm256_set1_epi32(static_cast<int>(pattern));
+		for (; i + 8 <= count; i += 8)
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), pattern8);
+#endif
+#if defined(__SSE2__)
+		const __m128i pattern4 = _mm_set1_epi32(static_cast<int>(pattern));
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), pattern4);
+#endif
+		for (; i < count; i++)
+			dst[i] = color;
+	}
+	else {
+		std::fill_n(dst, count, color);
+	}
+}
+
+/**
+ * The thread pool canvas operations split their work across.
+ * It defaults to one worker less than the hardware threads, since the
+ * calling thread takes part in the work as well.
+ */
+std::unique_ptr<ThreadPool>&
+canvas_thread_pool_storage()
+{
+	static std::unique_ptr<ThreadPool> pool = std::make_unique<ThreadPool>(
+		std::max(std::thread::hardware_concurrency(), 1u) - 1);
+	return pool;
+}
+
+ThreadPool&
+canvas_thread_pool()
+{
+	return *canvas_thread_pool_storage();
+}
+
+/**
+ * Replace the canvas thread pool with one of worker_count workers.
+ * Must not be called while canvas operations are running.
+ */
+void
+set_canvas_worker_count(const uint32_t worker_count)
+{
+	canvas_thread_pool_storage() = std::make_unique<ThreadPool>(worker_count);
+}
+
+/*Rows per band, bands are fixed so the split never depends on the worker count*/
+constexpr uint32_t canvas_band_rows = 32;
+/*Regions smaller than this many pixels are not worth handing to the pool*/
+constexpr uint64_t canvas_parallel_min_pixels = 1 << 16;
+
+/**
+ * Split a region into bands of whole rows and run f(band) for each of them
+ * on the canvas thread pool. The bands never overlap, so any op that only
+ * writes inside its band gives the same output for any worker count.
+ */
 template <typename F>
-decltype(auto) operator|(Canvas8bitRGBA&& canvas, F&& f)
+void
+for_each_canvas_band(const CanvasRect region, F&& f)
+{
+	const uint64_t pixel_count = uint64_t{region.extent.width} * region.extent.height;
+	if (pixel_count < canvas_parallel_min_pixels) {
+		f(region);
+		return;
+	}
+
+	const uint32_t band_count = (region.extent.height + canvas_band_rows - 1) / canvas_band_rows;
+	canvas_thread_pool().parallel_for(band_count, [&] (const uint32_t band)
+	{
+		const uint32_t first = band * canvas_band_rows;
+		const uint32_t rows = std::min(canvas_band_rows, region.extent.height - first);
+		f(CanvasRect{CanvasOffset{region.offset.x, region.offset.y + first},
+					 CanvasExtent{region.extent.width, rows}});
+	});
+}
+
+/**
+ * Run f(band) for bands of whole rows of a view, as subviews of it.
+ */
+template <typename Pixel, typename F>
+void
+for_each_canvas_band(const CanvasView<Pixel> view, F&& f)
+{
+	for_each_canvas_band(CanvasRect{CanvasOffset{0, 0}, view.extent}, [&] (const CanvasRect band)
+	{
+		f(subview(view, band));
+	});
+}
+
+template <PixelFormat Format, typename F>
+decltype(auto) operator|(Canvas<Format>&& canvas, F&& f)
 {
 	return std::invoke(std::forward<F>(f), std::move(canvas));
 }
 
+template <typename Pixel, typename F>
+decltype(auto) operator|(CanvasView<Pixel> view, F&& f)
+{
+	return std::invoke(std::forward<F>(f), view);
+}
+
+/**
+ * The canvas adopts the stb_image allocation of an RGBA bitmap directly,
+ * so the conversion neither allocates nor copies any pixels.
+ * BGRA bitmaps are swizzled back in place, RGB bitmaps are expanded
+ * into a new allocation.
+ */
 [[nodiscard]]
 Canvas8bitRGBA as_canvas(LoadedBitmap2D&& bitmap)
 {
-	if (bitmap.format != BitmapPixelFormat::RGBA)
-		throw std::runtime_error("Only RGBA format can be currently converted to canvas...");
-	
 	Canvas8bitRGBA canvas;
 	canvas.extent = CanvasExtent{static_cast<uint32_t>(bitmap.width),
 		                         static_cast<uint32_t>(bitmap.height)};
-	canvas.pixels.resize(bitmap.width * bitmap.height);
-	for (size_t i = 0; i < canvas.pixels.size(); i++) {
-		canvas.pixels[i] = Pixel8bitRGBA{bitmap.pixels[i*4+0],
-			                             bitmap.pixels[i*4+1],
-										 bitmap.pixels[i*4+2],
-										 bitmap.pixels[i*4+3]};
+	const size_t count = size_t{canvas.extent.width} * canvas.extent.height;
+
+	switch (bitmap.format) {
+	case BitmapPixelFormat::RGBA:
+		canvas.pixels = adopt_stbi_pixels(std::exchange(bitmap.pixels, nullptr), count);
+		return canvas;
+	case BitmapPixelFormat::BGRA:
+		swizzle_rgba_bgra(bitmap.pixels, bitmap.pixels, count);
+		canvas.pixels = adopt_stbi_pixels(std::exchange(bitmap.pixels, nullptr), count);
+		return canvas;
+	case BitmapPixelFormat::RGB:
+		canvas.pixels = allocate_canvas_pixels(count, Pixel8bitRGBA{0, 0, 0, 255});
+		expand_rgb_to_rgba(bitmap.pixels, get_pixels(canvas), count);
+		return canvas;
+	default:
+		break;
 	}
+	throw std::runtime_error("Bitmap format can not be converted to canvas...");
+}
 
-	return canvas;
+/**
+ * Fill every pixel of a view, one row span at a time.
+ */
+template <typename Pixel>
+void
+fill_rectangle(const CanvasView<Pixel> view, const std::type_identity_t<Pixel> color) noexcept
+{
+	for (uint32_t y = 0; y < view.extent.height; y++)
+		fill_span(view.row(y).data(), view.extent.width, color);
 }
 
-Canvas8bitRGBA
-draw_rectangle(const Pixel8bitRGBA color,
-			   const CanvasOffset offset,
-			   const CanvasExtent extent,
-			   Canvas8bitRGBA&& canvas)
+/**
+ * Fill the checkerboard pattern inside an already clipped region of a view,
+ * with the board starting at the view origin.
+ * A pixel is part of the board when its tile column and tile row add up to
+ * an even number, so every row is a fixed pattern of alternating spans.
+ */
+template <typename Pixel>
+void
+fill_checkerboard(const CanvasView<Pixel> view,
+				  const CanvasRect region,
+				  const std::type_identity_t<Pixel> color,
+				  const uint32_t size) noexcept
 {
-	for (uint32_t dw = 0; dw < extent.width; dw++) {
-		for (uint32_t dh = 0; dh < extent.height; dh++) {
-			auto accessor = canvas.at(offset.x + dw, offset.y + dh);
-			if (accessor.has_value()) 
-				accessor.value().get() = color;
+	const uint64_t first_x = region.offset.x;
+	const uint64_t last_x = first_x + region.extent.width;
+	const uint64_t first_column = first_x / size;
+
+	for (uint32_t y = region.offset.y; y < region.offset.y + region.extent.height; y++) {
+		auto* row = view.row(y).data();
+		const uint64_t tile_row = y / size;
+		const uint64_t column = first_column + ((first_column + tile_row) % 2);
+		for (uint64_t x = column * size; x < last_x; x += uint64_t{size} * 2) {
+			const uint64_t start = std::max(x, first_x);
+			const uint64_t end = std::min(x + size, last_x);
+			fill_span(row + start, end - start, color);
 		}
 	}
-	
+}
+
+template <typename Pixel>
+CanvasView<Pixel>
+draw_rectangle(const std::type_identity_t<Pixel> color,
+			   const CanvasOffset offset,
+			   const CanvasExtent extent,
+			   const CanvasView<Pixel> view)
+{
+	const auto clipped = clip_rectangle(offset, extent, view.extent);
+	if (!clipped)
+		return view;
+
+	for_each_canvas_band(subview(view, *clipped), [&] (const CanvasView<Pixel> band)
+	{
+		fill_rectangle(band, color);
+	});
+	return view;
+}
+
+template <PixelFormat Format>
+Canvas<Format>
+draw_rectangle(const typename Format::Pixel color,
+			   const CanvasOffset offset,
+			   const CanvasExtent extent,
+			   Canvas<Format>&& canvas)
+{
+	draw_rectangle(color, offset, extent, as_view(canvas));
+	if (const auto clipped = clip_rectangle(offset, extent, canvas.extent))
+		mark_damaged(canvas, *clipped);
 	return canvas;
 }
 
-decltype(auto) 
-draw_rectangle(const Pixel8bitRGBA color,
+template <typename Pixel>
+decltype(auto)
+draw_rectangle(const Pixel color,
 			   const CanvasOffset offset,
 			   const CanvasExtent extent)
 {
-	return [=] (Canvas8bitRGBA&& canvas) 
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
 	{
-		return draw_rectangle(color, offset, extent, std::move(canvas));
+		return draw_rectangle(color, offset, extent, std::forward<CanvasType>(canvas));
 	};
 }
 
-Canvas8bitRGBA
-draw_checkerboard(const Pixel8bitRGBA color, const uint32_t size, Canvas8bitRGBA&& canvas)
+/**
+ * The rows are split into bands across the canvas thread pool, each band
+ * writing its alternating spans directly.
+ */
+template <typename Pixel>
+CanvasView<Pixel>
+draw_checkerboard(const std::type_identity_t<Pixel> color,
+				  const uint32_t size,
+				  const CanvasView<Pixel> view)
 {
-	Canvas8bitRGBA board = std::move(canvas);
+	if (size == 0)
+		return view;
 
-	bool apply_width_offset = false;
-	for (uint32_t h = 0; h < board.extent.height; h += size) {
-		for (uint32_t w = 0; w < board.extent.width; w += size*2) {
-			const auto offset = (apply_width_offset) ? CanvasOffset{w + size, h}
-				: CanvasOffset{w, h};
-			const auto extent = CanvasExtent{size, size};
-			board = std::move(board) | draw_rectangle(color, offset, extent);
-		}
-		apply_width_offset = !apply_width_offset;
-	}
-	return board;
+	for_each_canvas_band(CanvasRect{CanvasOffset{0, 0}, view.extent}, [&] (const CanvasRect band)
+	{
+		fill_checkerboard(view, band, color, size);
+	});
+	return view;
 }
 
-decltype(auto) draw_checkerboard(const Pixel8bitRGBA color, const uint32_t size)
+template <PixelFormat Format>
+Canvas<Format>
+draw_checkerboard(const typename Format::Pixel color,
+				  const uint32_t size,
+				  Canvas<Format>&& canvas)
 {
-	return [=] (Canvas8bitRGBA&& canvas) 
+	draw_checkerboard(color, size, as_view(canvas));
+	if (size > 0 && canvas.extent.width > 0 && canvas.extent.height > 0)
+		mark_damaged(canvas, CanvasRect{CanvasOffset{0, 0}, canvas.extent});
+	return canvas;
+}
+
+template <typename Pixel>
+decltype(auto) draw_checkerboard(const Pixel color, const uint32_t size)
+{
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
 	{
-		return draw_checkerboard(color, size, std::move(canvas));
+		return draw_checkerboard(color, size, std::forward<CanvasType>(canvas));
 	};
 }
 
-Canvas8bitRGBA
-draw_coordinate_system(const CanvasExtent arrow, Canvas8bitRGBA&& canvas)
+/**
+ * Arrows along the axes and a marker in every corner, in fixed RGBA8
+ * colors, so it only takes canvases that RGBA8 rectangles can be drawn on.
+ */
+template <CanvasPipelineArgument CanvasType>
+	requires requires (CanvasType&& canvas) {
+		draw_rectangle(Pixel8bitRGBA{}, CanvasOffset{}, CanvasExtent{}, std::forward<CanvasType>(canvas));
+	}
+std::remove_cvref_t<CanvasType>
+draw_coordinate_system(const CanvasExtent arrow, CanvasType&& canvas)
 {
 	const auto green = Pixel8bitRGBA{0, 170, 0, 255};
 	const auto red = Pixel8bitRGBA{170, 0, 0, 255};
 	const auto blue = Pixel8bitRGBA{0, 0, 170, 255};
-	const auto canvas_extent = canvas.extent;
+	const auto canvas_extent = get_extent(canvas);
 
-	return std::move(canvas)
+	return std::forward<CanvasType>(canvas)
 		| draw_rectangle(green,
 						 CanvasOffset{arrow.width, 0},
 						 CanvasExtent{arrow.height, arrow.width})
@@ -215,8 +788,8 @@ draw_coordinate_system(const CanvasExtent arrow, Canvas8bitRGBA&& canvas)
 decltype(auto)
 draw_coordinate_system(const CanvasExtent arrow)
 {
-	return [=] (Canvas8bitRGBA&& canvas)
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
 	{
-		return draw_coordinate_system(arrow, std::move(canvas));
+		return draw_coordinate_system(arrow, std::forward<CanvasType>(canvas));
 	};
 }
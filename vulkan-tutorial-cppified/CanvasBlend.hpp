@@ -0,0 +1,304 @@
+#pragma once
+
+#include "Canvas.hpp"
+
+/**
+ * Alpha compositing onto a canvas.
+ * The canvas pixels are treated as premultiplied alpha, which is the same
+ * as straight alpha for opaque images like loaded jpgs. Colors passed to the
+ * blend ops are straight alpha and premultiplied once per op.
+ *
+ *   SourceOver: S + D * (1 - Sa)
+ *   Additive:   S + D, saturated
+ *   Multiply:   S * D + S * (1 - Da) + D * (1 - Sa)
+ */
+enum class BlendMode
+{
+	SourceOver,
+	Additive,
+	Multiply,
+};
+
+/*a * b / 255, correctly rounded for all 8bit inputs*/
+constexpr uint8_t
+multiply_255(const uint32_t a, const uint32_t b) noexcept
+{
+	const uint32_t t = a * b + 128;
+	return static_cast<uint8_t>((t + (t >> 8)) >> 8);
+}
+
+[[nodiscard]]
+constexpr Pixel8bitRGBA
+premultiply(const Pixel8bitRGBA color) noexcept
+{
+	return Pixel8bitRGBA{multiply_255(color.r, color.a),
+		                 multiply_255(color.g, color.a),
+						 multiply_255(color.b, color.a),
+						 color.a};
+}
+
+/**
+ * Scalar reference of the blend math for a single premultiplied pixel,
+ * the vectorized kernels give bit identical results.
+ */
+[[nodiscard]]
+constexpr Pixel8bitRGBA
+blend_pixel(const BlendMode mode, const Pixel8bitRGBA src, const Pixel8bitRGBA dst) noexcept
+{
+	const auto channel = [&] (const uint32_t s, const uint32_t d) -> uint8_t
+	{
+		switch (mode) {
+		case BlendMode::SourceOver:
+			return static_cast<uint8_t>(std::min<uint32_t>(s + multiply_255(d, 255 - src.a), 255u));
+		case BlendMode::Additive:
+			return static_cast<uint8_t>(std::min<uint32_t>(s + d, 255u));
+		case BlendMode::Multiply:
+			return static_cast<uint8_t>(std::min<uint32_t>(multiply_255(s, d)
+												 + multiply_255(s, 255 - dst.a)
+												 + multiply_255(d, 255 - src.a),
+												 255u));
+		}
+		return static_cast<uint8_t>(d);
+	};
+
+	return Pixel8bitRGBA{channel(src.r, dst.r),
+		                 channel(src.g, dst.g),
+						 channel(src.b, dst.b),
+						 channel(src.a, dst.a)};
+}
+
+void
+blend_span_scalar(const BlendMode mode,
+				  const Pixel8bitRGBA* src,
+				  Pixel8bitRGBA* dst,
+				  const size_t count) noexcept
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = blend_pixel(mode, src[i], dst[i]);
+}
+
+#if defined(__SSE2__)
+/*a * b / 255 on 16bit lanes holding 8bit values*/
+inline __m128i
+multiply_255_epi16(const __m128i a, const __m128i b) noexcept
+{
+	const __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+/*broadcast the alpha lane of both pixels held in 16bit lanes*/
+inline __m128i
+alpha_epi16(const __m128i pixels) noexcept
+{
+	const __m128i low = _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm_shufflehi_epi16(low, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+/*blend two pixels unpacked into 16bit lanes*/
+inline __m128i
+blend_epi16(const BlendMode mode, const __m128i s, const __m128i d) noexcept
+{
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i inverse_src_alpha = _mm_sub_epi16(full, alpha_epi16(s));
+	if (mode == BlendMode::SourceOver)
+		return _mm_add_epi16(s, multiply_255_epi16(d, inverse_src_alpha));
+
+	const __m128i inverse_dst_alpha = _mm_sub_epi16(full, alpha_epi16(d));
+	return _mm_add_epi16(_mm_add_epi16(multiply_255_epi16(s, d),
+									   multiply_255_epi16(s, inverse_dst_alpha)),
+						 multiply_255_epi16(d, inverse_src_alpha));
+}
+
+/*blend four pixels*/
+inline __m128i
+blend_4_pixels(const BlendMode mode, const __m128i src, const __m128i dst) noexcept
+{
+	if (mode == BlendMode::Additive)
+		return _mm_adds_epu8(src, dst);
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i low = blend_epi16(mode,
+									_mm_unpacklo_epi8(src, zero),
+									_mm_unpacklo_epi8(dst, zero));
+	const __m128i high = blend_epi16(mode,
+									 _mm_unpackhi_epi8(src, zero),
+									 _mm_unpackhi_epi8(dst, zero));
+	return _mm_packus_epi16(low, high);
+}
+#endif
+
+#if defined(__AVX2__)
+inline __m256i
+multiply_255_epi16(const __m256i a, const __m256i b) noexcept
+{
+	const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+inline __m256i
+alpha_epi16(const __m256i pixels) noexcept
+{
+	const __m256i low = _mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm256_shufflehi_epi16(low, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+inline __m256i
+blend_epi16(const BlendMode mode, const __m256i s, const __m256i d) noexcept
+{
+	const __m256i full = _mm256_set1_epi16(255);
+	const __m256i inverse_src_alpha = _mm256_sub_epi16(full, alpha_epi16(s));
+	if (mode == BlendMode::SourceOver)
+		return _mm256_add_epi16(s, multiply_255_epi16(d, inverse_src_alpha));
+
+	const __m256i inverse_dst_alpha = _mm256_sub_epi16(full, alpha_epi16(d));
+	return _mm256_add_epi16(_mm256_add_epi16(multiply_255_epi16(s, d),
+											 multiply_255_epi16(s, inverse_dst_alpha)),
+							multiply_255_epi16(d, inverse_src_alpha));
+}
+
+/*blend eight pixels, unpacking stays within the 128bit lanes so packing restores the order*/
+inline __m256i
+blend_8_pixels(const BlendMode mode, const __m256i src, const __m256i dst) noexcept
+{
+	if (mode == BlendMode::Additive)
+		return _mm256_adds_epu8(src, dst);
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i low = blend_epi16(mode,
+									_mm256_unpacklo_epi8(src, zero),
+									_mm256_unpacklo_epi8(dst, zero));
+	const __m256i high = blend_epi16(mode,
+									 _mm256_unpackhi_epi8(src, zero),
+									 _mm256_unpackhi_epi8(dst, zero));
+	return _mm256_packus_epi16(low, high);
+}
+#endif
+
+/**
+ * Blend a span of premultiplied source pixels onto the destination,
+ * 8 (AVX2) or 4 (SSE2) pixels at a time with a scalar tail.
+ */
+void
+blend_span(const BlendMode mode,
+		   const Pixel8bitRGBA* src,
+		   Pixel8bitRGBA* dst,
+		   const size_t count) noexcept
+{
+	size_t i = 0;
+#if defined(__AVX2__)
+	for (; i + 8 <= count; i += 8) {
+		const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), blend_8_pixels(mode, s, d));
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 4 <= count; i += 4) {
+		const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), blend_4_pixels(mode, s, d));
+	}
+#endif
+	blend_span_scalar(mode, src + i, dst + i, count - i);
+}
+
+/**
+ * Blend a single premultiplied color onto a span of the destination.
+ */
+void
+blend_span(const BlendMode mode,
+		   const Pixel8bitRGBA color,
+		   Pixel8bitRGBA* dst,
+		   const size_t count) noexcept
+{
+	[[maybe_unused]] uint32_t pattern;
+	std::memcpy(&pattern, &color, sizeof(pattern));
+
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256i color8 = _mm256_set1_epi32(static_cast<int>(pattern));
+	for (; i + 8 <= count; i += 8) {
+		const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), blend_8_pixels(mode, color8, d));
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i color4 = _mm_set1_epi32(static_cast<int>(pattern));
+	for (; i + 4 <= count; i += 4) {
+		const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), blend_4_pixels(mode, color4, d));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = blend_pixel(mode, color, dst[i]);
+}
+
+CanvasView8bitRGBA
+blend_rectangle(const BlendMode mode,
+				const Pixel8bitRGBA color,
+				const CanvasOffset offset,
+				const CanvasExtent extent,
+				const CanvasView8bitRGBA view)
+{
+	const auto clipped = clip_rectangle(offset, extent, view.extent);
+	if (!clipped)
+		return view;
+
+	const auto source = premultiply(color);
+	for_each_canvas_band(subview(view, *clipped), [&] (const CanvasView8bitRGBA band)
+	{
+		for (uint32_t y = 0; y < band.extent.height; y++)
+			blend_span(mode, source, band.row(y).data(), band.extent.width);
+	});
+	return view;
+}
+
+Canvas8bitRGBA
+blend_rectangle(const BlendMode mode,
+				const Pixel8bitRGBA color,
+				const CanvasOffset offset,
+				const CanvasExtent extent,
+				Canvas8bitRGBA&& canvas)
+{
+	blend_rectangle(mode, color, offset, extent, as_view(canvas));
+	if (const auto clipped = clip_rectangle(offset, extent, canvas.extent))
+		mark_damaged(canvas, *clipped);
+	return canvas;
+}
+
+decltype(auto)
+blend_rectangle(const BlendMode mode,
+				const Pixel8bitRGBA color,
+				const CanvasOffset offset,
+				const CanvasExtent extent)
+{
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
+	{
+		return blend_rectangle(mode, color, offset, extent, std::forward<CanvasType>(canvas));
+	};
+}
+
+/**
+ * Convert a straight alpha canvas (like a loaded png) to premultiplied alpha
+ * before blending onto it.
+ */
+CanvasView8bitRGBA
+premultiply_alpha(const CanvasView8bitRGBA view)
+{
+	for_each_canvas_band(view, [&] (const CanvasView8bitRGBA band)
+	{
+		for (uint32_t y = 0; y < band.extent.height; y++)
+			for (auto& pixel: band.row(y))
+				pixel = premultiply(pixel);
+	});
+	return view;
+}
+
+Canvas8bitRGBA
+premultiply_alpha(Canvas8bitRGBA&& canvas)
+{
+	premultiply_alpha(as_view(canvas));
+	if (canvas.extent.width > 0 && canvas.extent.height > 0)
+		mark_damaged(canvas, CanvasRect{CanvasOffset{0, 0}, canvas.extent});
+	return canvas;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "Canvas.hpp"
+
+#include <variant>
+#include <vector>
+
+/**
+ * Deferred canvas drawing.
+ * Instead of walking the pixel buffer once per draw op, the ops are recorded
+ * into a command list. When materialized the commands are binned into cache
+ * sized tiles, and every tile runs all of its commands in recorded order
+ * while it is still hot in L1/L2.
+ *
+ *   auto canvas = create_canvas(color, extent)
+ *       | defer_drawing
+ *       | draw_checkerboard(yellow, 100)
+ *       | draw_coordinate_system(CanvasExtent{20, 400})
+ *       | materialize;
+ */
+
+struct FillRectangleCommand
+{
+	Pixel8bitRGBA color;
+	CanvasRect rect;
+};
+
+struct CheckerboardCommand
+{
+	Pixel8bitRGBA color;
+	uint32_t size;
+};
+
+using CanvasCommand = std::variant<FillRectangleCommand,
+								   CheckerboardCommand>;
+
+/*512x16 RGBA pixels is 32KiB, wide tiles keep the row spans long enough
+  for the span stores, square 64x64 tiles were slower than drawing eagerly*/
+constexpr CanvasExtent canvas_tile_extent{512, 16};
+
+struct DeferredCanvas
+{
+	Canvas8bitRGBA canvas;
+	std::vector<CanvasCommand> commands;
+};
+
+[[nodiscard]]
+DeferredCanvas
+defer_drawing(Canvas8bitRGBA&& canvas)
+{
+	DeferredCanvas deferred{};
+	deferred.canvas = std::move(canvas);
+	return deferred;
+}
+
+template <typename F>
+decltype(auto) operator|(DeferredCanvas&& deferred, F&& f)
+{
+	return std::invoke(std::forward<F>(f), std::move(deferred));
+}
+
+[[nodiscard]]
+CanvasExtent
+get_extent(const DeferredCanvas& deferred) noexcept
+{
+	return deferred.canvas.extent;
+}
+
+DeferredCanvas
+draw_rectangle(const Pixel8bitRGBA color,
+			   const CanvasOffset offset,
+			   const CanvasExtent extent,
+			   DeferredCanvas&& deferred)
+{
+	const auto clipped = clip_rectangle(offset, extent, deferred.canvas.extent);
+	if (clipped)
+		deferred.commands.push_back(FillRectangleCommand{color, *clipped});
+	return deferred;
+}
+
+DeferredCanvas
+draw_checkerboard(const Pixel8bitRGBA color,
+				  const uint32_t size,
+				  DeferredCanvas&& deferred)
+{
+	if (size > 0)
+		deferred.commands.push_back(CheckerboardCommand{color, size});
+	return deferred;
+}
+
+[[nodiscard]]
+CanvasRect
+command_bounds(const CanvasCommand& command, const CanvasExtent canvas_extent) noexcept
+{
+	if (const auto* fill = std::get_if<FillRectangleCommand>(&command))
+		return fill->rect;
+	return CanvasRect{CanvasOffset{0, 0}, canvas_extent};
+}
+
+void
+apply_command(const CanvasCommand& command,
+			  const CanvasView8bitRGBA view,
+			  const CanvasRect tile) noexcept
+{
+	if (const auto* fill = std::get_if<FillRectangleCommand>(&command)) {
+		const auto clipped = intersect_rectangles(fill->rect, tile);
+		if (clipped)
+			fill_rectangle(subview(view, *clipped), fill->color);
+	}
+	else if (const auto* board = std::get_if<CheckerboardCommand>(&command)) {
+		fill_checkerboard(view, tile, board->color, board->size);
+	}
+}
+
+[[nodiscard]]
+Canvas8bitRGBA
+materialize(DeferredCanvas&& deferred)
+{
+	Canvas8bitRGBA canvas = std::move(deferred.canvas);
+	const auto extent = canvas.extent;
+	if (deferred.commands.empty() || extent.width == 0 || extent.height == 0)
+		return canvas;
+
+	const uint32_t tiles_x = (extent.width + canvas_tile_extent.width - 1)
+		/ canvas_tile_extent.width;
+	const uint32_t tiles_y = (extent.height + canvas_tile_extent.height - 1)
+		/ canvas_tile_extent.height;
+
+	/*bin the command indices per tile, keeping the recorded order*/
+	std::vector<std::vector<uint32_t>> bins(size_t{tiles_x} * tiles_y);
+	for (uint32_t i = 0; i < deferred.commands.size(); i++) {
+		const auto bounds = command_bounds(deferred.commands[i], extent);
+		const uint32_t first_x = bounds.offset.x / canvas_tile_extent.width;
+		const uint32_t first_y = bounds.offset.y / canvas_tile_extent.height;
+		const uint32_t last_x = (bounds.offset.x + bounds.extent.width - 1)
+			/ canvas_tile_extent.width;
+		const uint32_t last_y = (bounds.offset.y + bounds.extent.height - 1)
+			/ canvas_tile_extent.height;
+		for (uint32_t ty = first_y; ty <= last_y; ty++)
+			for (uint32_t tx = first_x; tx <= last_x; tx++)
+				bins[size_t{ty} * tiles_x + tx].push_back(i);
+		mark_damaged(canvas, bounds);
+	}
+
+	/*every row of tiles is an independent job on the canvas thread pool*/
+	const auto view = as_view(canvas);
+	canvas_thread_pool().parallel_for(tiles_y, [&] (const uint32_t ty)
+	{
+		for (uint32_t tx = 0; tx < tiles_x; tx++) {
+			const auto tile = clip_rectangle(CanvasOffset{tx * canvas_tile_extent.width,
+														  ty * canvas_tile_extent.height},
+											 canvas_tile_extent,
+											 extent);
+			for (const uint32_t i: bins[size_t{ty} * tiles_x + tx])
+				apply_command(deferred.commands[i], view, *tile);
+		}
+	});
+
+	return canvas;
+}
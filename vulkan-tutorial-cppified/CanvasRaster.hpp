@@ -0,0 +1,489 @@
+#pragma once
+
+#include "CanvasBlend.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <span>
+#include <vector>
+
+/**
+ * Scanline rasterization of lines, circles, triangles and polygons.
+ * Every shape is reduced to the horizontal spans it covers on a sample
+ * row, and the spans are written with the span fill and blend kernels.
+ *
+ * Without antialiasing a pixel is covered when its center is inside the
+ * shape, and covered pixels are overwritten like draw_rectangle does.
+ * With coverage antialiasing every pixel row is sampled on 4 sub rows with
+ * exact horizontal coverage, and the color is blended SourceOver scaled by
+ * the covered area.
+ *
+ * Coordinates are floats in pixels, the center of pixel (x, y) is at
+ * (x + 0.5, y + 0.5).
+ */
+struct CanvasPoint
+{
+	float x;
+	float y;
+};
+
+enum class CanvasAntialiasing
+{
+	None,
+	Coverage,
+};
+
+/*a run [begin, end) of a shape along one sample row*/
+struct RasterSpan
+{
+	float begin;
+	float end;
+};
+
+constexpr uint32_t raster_subsamples = 4;
+
+/**
+ * The pixels a shape with the given bounds can touch, clipped to the view.
+ */
+[[nodiscard]]
+std::optional<CanvasRect>
+raster_bounds(const float min_x,
+			  const float min_y,
+			  const float max_x,
+			  const float max_y,
+			  const CanvasExtent extent) noexcept
+{
+	const float width = static_cast<float>(extent.width);
+	const float height = static_cast<float>(extent.height);
+	const float first_x = std::clamp(std::floor(min_x), 0.0f, width);
+	const float first_y = std::clamp(std::floor(min_y), 0.0f, height);
+	const float last_x = std::clamp(std::ceil(max_x), 0.0f, width);
+	const float last_y = std::clamp(std::ceil(max_y), 0.0f, height);
+	if (!(last_x > first_x && last_y > first_y))
+		return std::nullopt;
+
+	return CanvasRect{CanvasOffset{static_cast<uint32_t>(first_x), static_cast<uint32_t>(first_y)},
+					  CanvasExtent{static_cast<uint32_t>(last_x - first_x),
+								   static_cast<uint32_t>(last_y - first_y)}};
+}
+
+/*write the pixel centers inside each span*/
+void
+raster_row(Pixel8bitRGBA* row,
+		   const uint32_t first_x,
+		   const uint32_t last_x,
+		   const std::vector<RasterSpan>& spans,
+		   const Pixel8bitRGBA color) noexcept
+{
+	for (const auto& span: spans) {
+		const float begin = std::ceil(span.begin - 0.5f);
+		const float end = std::ceil(span.end - 0.5f);
+		const uint32_t x0 = static_cast<uint32_t>(std::clamp(begin, float(first_x), float(last_x)));
+		const uint32_t x1 = static_cast<uint32_t>(std::clamp(end, float(first_x), float(last_x)));
+		if (x1 > x0)
+			fill_span(row + x0, x1 - x0, color);
+	}
+}
+
+/*scratch of one rasterizing thread, reused between rows and shapes*/
+struct RasterScratch
+{
+	std::vector<RasterSpan> spans;
+	/*difference array of fully covered pixels*/
+	std::vector<float> cover;
+	/*partial coverage at span ends*/
+	std::vector<float> area;
+};
+
+RasterScratch&
+raster_scratch()
+{
+	thread_local RasterScratch scratch{};
+	return scratch;
+}
+
+/**
+ * Accumulate the coverage of one pixel row from its sub rows, then write
+ * fully covered runs as spans and blend the partially covered pixels one
+ * at a time.
+ */
+template <typename SpansAt>
+void
+raster_row_antialiased(Pixel8bitRGBA* row,
+					   const uint32_t y,
+					   const uint32_t first_x,
+					   const uint32_t last_x,
+					   const Pixel8bitRGBA color,
+					   RasterScratch& scratch,
+					   const SpansAt& spans_at)
+{
+	const uint32_t width = last_x - first_x;
+	scratch.cover.assign(width + 2, 0.0f);
+	scratch.area.assign(width + 2, 0.0f);
+
+	constexpr float weight = 1.0f / raster_subsamples;
+	for (uint32_t s = 0; s < raster_subsamples; s++) {
+		spans_at(static_cast<float>(y) + (static_cast<float>(s) + 0.5f) * weight, scratch.spans);
+		for (const auto& span: scratch.spans) {
+			const float begin = std::clamp(span.begin, float(first_x), float(last_x)) - first_x;
+			const float end = std::clamp(span.end, float(first_x), float(last_x)) - first_x;
+			if (!(end > begin))
+				continue;
+
+			const auto first = static_cast<uint32_t>(begin);
+			const auto last = static_cast<uint32_t>(end);
+			if (first == last) {
+				scratch.area[first] += (end - begin) * weight;
+				continue;
+			}
+			scratch.area[first] += (static_cast<float>(first + 1) - begin) * weight;
+			scratch.cover[first + 1] += weight;
+			scratch.cover[last] -= weight;
+			scratch.area[last] += (end - static_cast<float>(last)) * weight;
+		}
+	}
+
+	const Pixel8bitRGBA source = premultiply(color);
+	const bool opaque = color.a == 255;
+	constexpr float full = 1.0f - 0.5f / 255.0f;
+	constexpr float empty = 0.5f / 255.0f;
+
+	float covered = 0.0f;
+	uint32_t x = 0;
+	while (x < width) {
+		covered += scratch.cover[x];
+		const float coverage = std::min(covered + scratch.area[x], 1.0f);
+		if (coverage >= full) {
+			/*extend over the run of fully covered pixels*/
+			uint32_t end = x + 1;
+			float run_covered = covered;
+			while (end < width) {
+				const float next = run_covered + scratch.cover[end];
+				if (std::min(next + scratch.area[end], 1.0f) < full)
+					break;
+				run_covered = next;
+				end++;
+			}
+			if (opaque)
+				fill_span(row + first_x + x, end - x, color);
+			else
+				blend_span(BlendMode::SourceOver, source, row + first_x + x, end - x);
+			covered = run_covered;
+			x = end;
+			continue;
+		}
+		if (coverage > empty) {
+			const auto alpha = static_cast<uint32_t>(coverage * 255.0f + 0.5f);
+			const auto scaled = Pixel8bitRGBA{multiply_255(source.r, alpha),
+											  multiply_255(source.g, alpha),
+											  multiply_255(source.b, alpha),
+											  multiply_255(source.a, alpha)};
+			row[first_x + x] = blend_pixel(BlendMode::SourceOver, scaled, row[first_x + x]);
+		}
+		x++;
+	}
+}
+
+/**
+ * Rasterize a shape given by spans_at(sample_y, spans), which replaces
+ * spans with the sorted, non overlapping runs of the shape on that row.
+ * Bands of rows are split across the canvas thread pool for large shapes.
+ */
+template <typename SpansAt>
+void
+rasterize(const CanvasView8bitRGBA view,
+		  const CanvasRect bounds,
+		  const Pixel8bitRGBA color,
+		  const CanvasAntialiasing antialiasing,
+		  const SpansAt& spans_at)
+{
+	const uint32_t first_x = bounds.offset.x;
+	const uint32_t last_x = bounds.offset.x + bounds.extent.width;
+	for_each_canvas_band(bounds, [&] (const CanvasRect band)
+	{
+		RasterScratch& scratch = raster_scratch();
+		for (uint32_t y = band.offset.y; y < band.offset.y + band.extent.height; y++) {
+			Pixel8bitRGBA* row = view.row(y).data();
+			if (antialiasing == CanvasAntialiasing::Coverage) {
+				raster_row_antialiased(row, y, first_x, last_x, color, scratch, spans_at);
+			}
+			else {
+				spans_at(static_cast<float>(y) + 0.5f, scratch.spans);
+				raster_row(row, first_x, last_x, scratch.spans, color);
+			}
+		}
+	});
+}
+
+/*a polygon edge that is not horizontal, with y0 < y1*/
+struct RasterEdge
+{
+	float x0;
+	float y0;
+	float y1;
+	float dxdy;
+	int winding;
+};
+
+struct RasterCrossing
+{
+	float x;
+	int winding;
+};
+
+/**
+ * Fill a polygon with the nonzero winding rule, so self intersecting and
+ * concave polygons fill the way vector graphics do.
+ */
+CanvasView8bitRGBA
+fill_polygon(const Pixel8bitRGBA color,
+			 const std::span<const CanvasPoint> points,
+			 const CanvasAntialiasing antialiasing,
+			 const CanvasView8bitRGBA view)
+{
+	if (points.size() < 3)
+		return view;
+
+	std::vector<RasterEdge> edges{};
+	edges.reserve(points.size());
+	float min_x = points[0].x, max_x = points[0].x;
+	float min_y = points[0].y, max_y = points[0].y;
+	for (size_t i = 0; i < points.size(); i++) {
+		const CanvasPoint a = points[i];
+		const CanvasPoint b = points[(i + 1) % points.size()];
+		min_x = std::min(min_x, a.x);
+		max_x = std::max(max_x, a.x);
+		min_y = std::min(min_y, a.y);
+		max_y = std::max(max_y, a.y);
+		if (a.y == b.y)
+			continue;
+		const bool down = a.y < b.y;
+		const CanvasPoint top = down ? a : b;
+		const CanvasPoint bottom = down ? b : a;
+		edges.push_back(RasterEdge{top.x,
+								   top.y,
+								   bottom.y,
+								   (bottom.x - top.x) / (bottom.y - top.y),
+								   down ? 1 : -1});
+	}
+
+	const auto bounds = raster_bounds(min_x, min_y, max_x, max_y, view.extent);
+	if (!bounds || edges.empty())
+		return view;
+
+	rasterize(view, *bounds, color, antialiasing,
+			  [&] (const float y, std::vector<RasterSpan>& spans)
+	{
+		thread_local std::vector<RasterCrossing> crossings{};
+		crossings.clear();
+		for (const auto& edge: edges)
+			if (y >= edge.y0 && y < edge.y1)
+				crossings.push_back(RasterCrossing{edge.x0 + (y - edge.y0) * edge.dxdy, edge.winding});
+		std::sort(crossings.begin(), crossings.end(),
+				  [] (const RasterCrossing& a, const RasterCrossing& b) { return a.x < b.x; });
+
+		spans.clear();
+		int winding = 0;
+		for (const auto& crossing: crossings) {
+			const int next = winding + crossing.winding;
+			if (winding == 0 && next != 0)
+				spans.push_back(RasterSpan{crossing.x, crossing.x});
+			else if (winding != 0 && next == 0)
+				spans.back().end = crossing.x;
+			winding = next;
+		}
+	});
+	return view;
+}
+
+Canvas8bitRGBA
+fill_polygon(const Pixel8bitRGBA color,
+			 const std::span<const CanvasPoint> points,
+			 const CanvasAntialiasing antialiasing,
+			 Canvas8bitRGBA&& canvas)
+{
+	fill_polygon(color, points, antialiasing, as_view(canvas));
+	if (points.empty())
+		return canvas;
+
+	float min_x = points[0].x, max_x = points[0].x;
+	float min_y = points[0].y, max_y = points[0].y;
+	for (const auto& point: points) {
+		min_x = std::min(min_x, point.x);
+		max_x = std::max(max_x, point.x);
+		min_y = std::min(min_y, point.y);
+		max_y = std::max(max_y, point.y);
+	}
+	if (const auto bounds = raster_bounds(min_x, min_y, max_x, max_y, canvas.extent))
+		mark_damaged(canvas, *bounds);
+	return canvas;
+}
+
+decltype(auto)
+fill_polygon(const Pixel8bitRGBA color,
+			 std::vector<CanvasPoint> points,
+			 const CanvasAntialiasing antialiasing = CanvasAntialiasing::None)
+{
+	return [=, points = std::move(points)] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
+	{
+		return fill_polygon(color, std::span<const CanvasPoint>(points), antialiasing, std::forward<CanvasType>(canvas));
+	};
+}
+
+template <CanvasPipelineArgument CanvasType>
+std::remove_cvref_t<CanvasType>
+draw_triangle(const Pixel8bitRGBA color,
+			  const CanvasPoint a,
+			  const CanvasPoint b,
+			  const CanvasPoint c,
+			  const CanvasAntialiasing antialiasing,
+			  CanvasType&& canvas)
+{
+	const CanvasPoint points[3] = {a, b, c};
+	return fill_polygon(color, std::span<const CanvasPoint>(points), antialiasing, std::forward<CanvasType>(canvas));
+}
+
+decltype(auto)
+draw_triangle(const Pixel8bitRGBA color,
+			  const CanvasPoint a,
+			  const CanvasPoint b,
+			  const CanvasPoint c,
+			  const CanvasAntialiasing antialiasing = CanvasAntialiasing::None)
+{
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
+	{
+		return draw_triangle(color, a, b, c, antialiasing, std::forward<CanvasType>(canvas));
+	};
+}
+
+/**
+ * A line is filled as the rectangle of the given width around the segment
+ * from one end point to the other.
+ */
+template <CanvasPipelineArgument CanvasType>
+std::remove_cvref_t<CanvasType>
+draw_line(const Pixel8bitRGBA color,
+		  const CanvasPoint from,
+		  const CanvasPoint to,
+		  const float width,
+		  const CanvasAntialiasing antialiasing,
+		  CanvasType&& canvas)
+{
+	const float dx = to.x - from.x;
+	const float dy = to.y - from.y;
+	const float length = std::sqrt(dx * dx + dy * dy);
+	if (length == 0.0f || !(width > 0.0f))
+		return std::forward<CanvasType>(canvas);
+
+	const float nx = -dy / length * width * 0.5f;
+	const float ny = dx / length * width * 0.5f;
+	const CanvasPoint points[4] = {CanvasPoint{from.x + nx, from.y + ny},
+								   CanvasPoint{to.x + nx, to.y + ny},
+								   CanvasPoint{to.x - nx, to.y - ny},
+								   CanvasPoint{from.x - nx, from.y - ny}};
+	return fill_polygon(color, std::span<const CanvasPoint>(points), antialiasing, std::forward<CanvasType>(canvas));
+}
+
+decltype(auto)
+draw_line(const Pixel8bitRGBA color,
+		  const CanvasPoint from,
+		  const CanvasPoint to,
+		  const float width = 1.0f,
+		  const CanvasAntialiasing antialiasing = CanvasAntialiasing::None)
+{
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
+	{
+		return draw_line(color, from, to, width, antialiasing, std::forward<CanvasType>(canvas));
+	};
+}
+
+/**
+ * Fill the ring between inner_radius and radius, a zero inner radius
+ * fills the whole disc.
+ */
+CanvasView8bitRGBA
+fill_ring(const Pixel8bitRGBA color,
+		  const CanvasPoint center,
+		  const float radius,
+		  const float inner_radius,
+		  const CanvasAntialiasing antialiasing,
+		  const CanvasView8bitRGBA view)
+{
+	if (!(radius > 0.0f))
+		return view;
+
+	const auto bounds = raster_bounds(center.x - radius, center.y - radius,
+									  center.x + radius, center.y + radius,
+									  view.extent);
+	if (!bounds)
+		return view;
+
+	const float outer_squared = radius * radius;
+	const float inner_squared = std::max(inner_radius, 0.0f) * std::max(inner_radius, 0.0f);
+	rasterize(view, *bounds, color, antialiasing,
+			  [&] (const float y, std::vector<RasterSpan>& spans)
+	{
+		spans.clear();
+		const float dy = y - center.y;
+		const float dy_squared = dy * dy;
+		if (dy_squared >= outer_squared)
+			return;
+
+		const float outer = std::sqrt(outer_squared - dy_squared);
+		if (dy_squared >= inner_squared) {
+			spans.push_back(RasterSpan{center.x - outer, center.x + outer});
+			return;
+		}
+		const float inner = std::sqrt(inner_squared - dy_squared);
+		spans.push_back(RasterSpan{center.x - outer, center.x - inner});
+		spans.push_back(RasterSpan{center.x + inner, center.x + outer});
+	});
+	return view;
+}
+
+Canvas8bitRGBA
+fill_ring(const Pixel8bitRGBA color,
+		  const CanvasPoint center,
+		  const float radius,
+		  const float inner_radius,
+		  const CanvasAntialiasing antialiasing,
+		  Canvas8bitRGBA&& canvas)
+{
+	fill_ring(color, center, radius, inner_radius, antialiasing, as_view(canvas));
+	if (!(radius > 0.0f))
+		return canvas;
+
+	const auto bounds = raster_bounds(center.x - radius, center.y - radius,
+									  center.x + radius, center.y + radius,
+									  canvas.extent);
+	if (bounds)
+		mark_damaged(canvas, *bounds);
+	return canvas;
+}
+
+decltype(auto)
+fill_circle(const Pixel8bitRGBA color,
+			const CanvasPoint center,
+			const float radius,
+			const CanvasAntialiasing antialiasing = CanvasAntialiasing::None)
+{
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
+	{
+		return fill_ring(color, center, radius, 0.0f, antialiasing, std::forward<CanvasType>(canvas));
+	};
+}
+
+/*a circle outline of the given width, centered on the radius*/
+decltype(auto)
+draw_circle(const Pixel8bitRGBA color,
+			const CanvasPoint center,
+			const float radius,
+			const float width = 1.0f,
+			const CanvasAntialiasing antialiasing = CanvasAntialiasing::None)
+{
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
+	{
+		return fill_ring(color, center, radius + width * 0.5f, radius - width * 0.5f,
+						 antialiasing, std::forward<CanvasType>(canvas));
+	};
+}
@@ -0,0 +1,323 @@
+#pragma once
+
+#include "Canvas.hpp"
+
+#include <cmath>
+#include <vector>
+
+/**
+ * Scaled copies of one canvas into another on the cpu.
+ * Bilinear and Lanczos resampling are separable, a horizontal pass filters
+ * the source rows into rows of floats at the destination width, and a
+ * vertical pass filters those into the destination rows. When shrinking,
+ * the filters are widened by the scale so every source pixel contributes.
+ * Source pixels past the edges repeat the edge pixels.
+ */
+enum class ResampleFilter
+{
+	Nearest,
+	Bilinear,
+	Lanczos,
+};
+
+/*lobes of the Lanczos filter on either side of the center*/
+constexpr double lanczos_radius = 3.0;
+
+/**
+ * The source pixels that make up each destination pixel along one axis.
+ * Every destination pixel reads taps neighbouring source pixels from its
+ * first one, the windows are moved inside the source so no reads need
+ * clamping.
+ */
+struct ResampleAxis
+{
+	uint32_t taps{0};
+	std::vector<uint32_t> first;
+	/*taps weights per destination pixel, summing to 1*/
+	std::vector<float> weights;
+};
+
+[[nodiscard]]
+double
+resample_kernel(const ResampleFilter filter, const double x) noexcept
+{
+	const double distance = std::abs(x);
+	if (filter == ResampleFilter::Bilinear)
+		return std::max(1.0 - distance, 0.0);
+
+	if (distance < 1e-8)
+		return 1.0;
+	if (distance >= lanczos_radius)
+		return 0.0;
+	constexpr double pi = 3.14159265358979323846;
+	const double t = pi * distance;
+	return lanczos_radius * std::sin(t) * std::sin(t / lanczos_radius) / (t * t);
+}
+
+/**
+ * The axis of count destination pixels from first_pixel on, out of
+ * dst_size pixels spanning the src_size source pixels.
+ */
+[[nodiscard]]
+ResampleAxis
+resample_axis(const ResampleFilter filter,
+			  const uint32_t src_size,
+			  const uint32_t dst_size,
+			  const uint32_t first_pixel,
+			  const uint32_t count)
+{
+	const double scale = static_cast<double>(src_size) / dst_size;
+	const double filter_scale = std::max(scale, 1.0);
+	const double radius = (filter == ResampleFilter::Bilinear ? 1.0 : lanczos_radius) * filter_scale;
+
+	ResampleAxis axis{};
+	axis.taps = std::min(static_cast<uint32_t>(std::ceil(radius * 2.0)) + 1, src_size);
+	axis.first.resize(count);
+	axis.weights.assign(size_t{count} * axis.taps, 0.0f);
+
+	const auto last_first = static_cast<int64_t>(src_size - axis.taps);
+	std::vector<double> sums(axis.taps);
+	for (uint32_t i = 0; i < count; i++) {
+		const double center = (first_pixel + i + 0.5) * scale - 0.5;
+		const auto lowest = static_cast<int64_t>(std::ceil(center - radius));
+		const auto highest = static_cast<int64_t>(std::floor(center + radius));
+		const int64_t first = std::clamp<int64_t>(lowest, 0, last_first);
+		axis.first[i] = static_cast<uint32_t>(first);
+
+		float* weights = axis.weights.data() + size_t{i} * axis.taps;
+		double total = 0.0;
+		std::fill(sums.begin(), sums.end(), 0.0);
+		for (int64_t j = lowest; j <= highest; j++) {
+			const double weight = resample_kernel(filter, (static_cast<double>(j) - center) / filter_scale);
+			const int64_t source = std::clamp<int64_t>(j, 0, int64_t{src_size} - 1);
+			sums[source - first] += weight;
+			total += weight;
+		}
+
+		if (total == 0.0) {
+			const int64_t nearest = std::clamp<int64_t>(std::llround(center), 0, int64_t{src_size} - 1);
+			weights[nearest - first] = 1.0f;
+			continue;
+		}
+		for (uint32_t t = 0; t < axis.taps; t++)
+			weights[t] = static_cast<float>(sums[t] / total);
+	}
+	return axis;
+}
+
+/**
+ * The horizontal pass over the source rows of band, each into a row of
+ * 4 floats per destination pixel. Rows of band are relative to first_row.
+ */
+void
+resample_rows(const CanvasView<const Pixel8bitRGBA> source,
+			  const ResampleAxis& axis,
+			  const uint32_t first_row,
+			  float* dst,
+			  const CanvasRect band) noexcept
+{
+	const size_t width = axis.first.size();
+	for (uint32_t y = band.offset.y; y < band.offset.y + band.extent.height; y++) {
+		const Pixel8bitRGBA* row = source.row(first_row + y).data();
+		float* out = dst + size_t{y} * width * 4;
+		for (size_t x = 0; x < width; x++) {
+			const Pixel8bitRGBA* taps = row + axis.first[x];
+			const float* weights = axis.weights.data() + x * axis.taps;
+#if defined(__SSE2__)
+			const __m128i zero = _mm_setzero_si128();
+			__m128 sum = _mm_setzero_ps();
+			for (uint32_t t = 0; t < axis.taps; t++) {
+				int32_t pattern;
+				std::memcpy(&pattern, taps + t, sizeof(pattern));
+				const __m128i bytes = _mm_cvtsi32_si128(pattern);
+				const __m128 pixel = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+				sum = _mm_add_ps(sum, _mm_mul_ps(pixel, _mm_set1_ps(weights[t])));
+			}
+			_mm_storeu_ps(out + x * 4, sum);
+#else
+			float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+			for (uint32_t t = 0; t < axis.taps; t++) {
+				sum[0] += taps[t].r * weights[t];
+				sum[1] += taps[t].g * weights[t];
+				sum[2] += taps[t].b * weights[t];
+				sum[3] += taps[t].a * weights[t];
+			}
+			std::memcpy(out + x * 4, sum, sizeof(sum));
+#endif
+		}
+	}
+}
+
+/**
+ * The vertical pass into the destination rows of band, adding up whole
+ * filtered rows so the loads stay contiguous, then rounding and clamping
+ * back to 8bit. Rows of band are relative to the first row of the axis.
+ */
+void
+resample_columns(const float* src,
+				 const uint32_t first_row,
+				 const ResampleAxis& axis,
+				 const CanvasView8bitRGBA destination,
+				 const CanvasRect band)
+{
+	const size_t row_floats = size_t{destination.extent.width} * 4;
+	thread_local std::vector<float> sum{};
+	sum.resize(row_floats);
+
+	for (uint32_t y = band.offset.y; y < band.offset.y + band.extent.height; y++) {
+		std::fill(sum.begin(), sum.end(), 0.0f);
+		const float* weights = axis.weights.data() + size_t{y} * axis.taps;
+		for (uint32_t t = 0; t < axis.taps; t++) {
+			const float* row = src + (axis.first[y] + t - first_row) * row_floats;
+			size_t i = 0;
+#if defined(__SSE2__)
+			const __m128 weight = _mm_set1_ps(weights[t]);
+			for (; i + 4 <= row_floats; i += 4) {
+				const __m128 added = _mm_add_ps(_mm_loadu_ps(sum.data() + i),
+												_mm_mul_ps(_mm_loadu_ps(row + i), weight));
+				_mm_storeu_ps(sum.data() + i, added);
+			}
+#endif
+			for (; i < row_floats; i++)
+				sum[i] += row[i] * weights[t];
+		}
+
+		Pixel8bitRGBA* out = destination.row(y).data();
+		uint32_t x = 0;
+#if defined(__SSE2__)
+		/*cvtps rounds to nearest, the packs saturate to [0, 255]*/
+		for (; x + 4 <= destination.extent.width; x += 4) {
+			const float* pixels = sum.data() + size_t{x} * 4;
+			const __m128i low = _mm_packs_epi32(_mm_cvtps_epi32(_mm_loadu_ps(pixels)),
+												_mm_cvtps_epi32(_mm_loadu_ps(pixels + 4)));
+			const __m128i high = _mm_packs_epi32(_mm_cvtps_epi32(_mm_loadu_ps(pixels + 8)),
+												 _mm_cvtps_epi32(_mm_loadu_ps(pixels + 12)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(low, high));
+		}
+#endif
+		for (; x < destination.extent.width; x++) {
+			const auto channel = [&] (const size_t c)
+			{
+				return static_cast<uint8_t>(std::clamp(std::nearbyint(sum[size_t{x} * 4 + c]), 0.0f, 255.0f));
+			};
+			out[x] = Pixel8bitRGBA{channel(0), channel(1), channel(2), channel(3)};
+		}
+	}
+}
+
+/**
+ * Nearest neighbour picks the source pixel under every destination pixel
+ * center, a plain gather without any filtering.
+ */
+void
+resample_nearest(const CanvasView<const Pixel8bitRGBA> source,
+				 const CanvasExtent scaled,
+				 const CanvasOffset first_pixel,
+				 const CanvasView8bitRGBA destination)
+{
+	std::vector<uint32_t> columns(destination.extent.width);
+	const double scale_x = static_cast<double>(source.extent.width) / scaled.width;
+	const double scale_y = static_cast<double>(source.extent.height) / scaled.height;
+	for (uint32_t x = 0; x < destination.extent.width; x++)
+		columns[x] = std::min(static_cast<uint32_t>((first_pixel.x + x + 0.5) * scale_x),
+							  source.extent.width - 1);
+
+	const auto whole = CanvasRect{CanvasOffset{0, 0}, destination.extent};
+	for_each_canvas_band(whole, [&] (const CanvasRect band)
+	{
+		for (uint32_t y = band.offset.y; y < band.offset.y + band.extent.height; y++) {
+			const auto source_y = std::min(static_cast<uint32_t>((first_pixel.y + y + 0.5) * scale_y),
+										   source.extent.height - 1);
+			const Pixel8bitRGBA* src = source.row(source_y).data();
+			Pixel8bitRGBA* out = destination.row(y).data();
+			for (uint32_t x = 0; x < destination.extent.width; x++)
+				out[x] = src[columns[x]];
+		}
+	});
+}
+
+/**
+ * Draw the whole source scaled to fill rect, clipped to the view.
+ * The source must not overlap the pixels of the view.
+ */
+CanvasView8bitRGBA
+draw_canvas(const CanvasView<const Pixel8bitRGBA> source,
+			const CanvasRect rect,
+			const ResampleFilter filter,
+			const CanvasView8bitRGBA view)
+{
+	const auto clipped = clip_rectangle(rect.offset, rect.extent, view.extent);
+	if (!clipped || source.empty())
+		return view;
+
+	const CanvasView8bitRGBA destination = subview(view, *clipped);
+	/*where the clipped pixels start inside the scaled source*/
+	const auto first_pixel = CanvasOffset{clipped->offset.x - rect.offset.x,
+										  clipped->offset.y - rect.offset.y};
+
+	if (filter == ResampleFilter::Nearest) {
+		resample_nearest(source, rect.extent, first_pixel, destination);
+		return view;
+	}
+
+	const ResampleAxis horizontal = resample_axis(filter, source.extent.width, rect.extent.width,
+												  first_pixel.x, clipped->extent.width);
+	const ResampleAxis vertical = resample_axis(filter, source.extent.height, rect.extent.height,
+												first_pixel.y, clipped->extent.height);
+
+	/*only the source rows some destination row reads are filtered*/
+	const uint32_t first_row = vertical.first.front();
+	const uint32_t last_row = vertical.first.back() + vertical.taps;
+	std::vector<float> filtered(size_t{last_row - first_row} * clipped->extent.width * 4);
+
+	const auto rows = CanvasRect{CanvasOffset{0, 0},
+		                         CanvasExtent{clipped->extent.width, last_row - first_row}};
+	for_each_canvas_band(rows, [&] (const CanvasRect band)
+	{
+		resample_rows(source, horizontal, first_row, filtered.data(), band);
+	});
+	const auto whole = CanvasRect{CanvasOffset{0, 0}, clipped->extent};
+	for_each_canvas_band(whole, [&] (const CanvasRect band)
+	{
+		resample_columns(filtered.data(), first_row, vertical, destination, band);
+	});
+	return view;
+}
+
+Canvas8bitRGBA
+draw_canvas(const CanvasView<const Pixel8bitRGBA> source,
+			const CanvasRect rect,
+			const ResampleFilter filter,
+			Canvas8bitRGBA&& canvas)
+{
+	draw_canvas(source, rect, filter, as_view(canvas));
+	const auto clipped = clip_rectangle(rect.offset, rect.extent, canvas.extent);
+	if (clipped && !source.empty())
+		mark_damaged(canvas, *clipped);
+	return canvas;
+}
+
+/*the source is not copied, it must outlive the pipeline*/
+decltype(auto)
+draw_canvas(const CanvasView<const Pixel8bitRGBA> source,
+			const CanvasRect rect,
+			const ResampleFilter filter = ResampleFilter::Bilinear)
+{
+	return [=] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
+	{
+		return draw_canvas(source, rect, filter, std::forward<CanvasType>(canvas));
+	};
+}
+
+/**
+ * A scaled copy of a canvas, like a thumbnail.
+ */
+[[nodiscard]]
+Canvas8bitRGBA
+resize_canvas(const Canvas8bitRGBA& canvas,
+			  const CanvasExtent extent,
+			  const ResampleFilter filter = ResampleFilter::Lanczos)
+{
+	return create_canvas(Pixel8bitRGBA{0, 0, 0, 0}, extent)
+		| draw_canvas(as_view(canvas), CanvasRect{CanvasOffset{0, 0}, extent}, filter);
+}
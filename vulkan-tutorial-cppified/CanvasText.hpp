@@ -0,0 +1,319 @@
+#pragma once
+
+#include "Canvas.hpp"
+
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/**
+ * Text drawing from a pre-rasterized glyph atlas.
+ * The font is a fixed 5x7 pixel font of printable ASCII, every glyph cell
+ * is 6x8 pixels with the spacing included. Atlases are rasterized once
+ * per integer scale into per pixel masks and cached, so drawing a string
+ * is only masked stores of the glyph rows into the canvas.
+ */
+constexpr char font_first_glyph = ' ';
+constexpr char font_last_glyph = '~';
+constexpr uint32_t font_glyph_count = font_last_glyph - font_first_glyph + 1;
+constexpr CanvasExtent font_glyph_extent{5, 7};
+constexpr CanvasExtent font_cell_extent{6, 8};
+
+/*5 columns per glyph from the left, bit 0 is the top row*/
+constexpr std::array<std::array<uint8_t, 5>, font_glyph_count> font_5x7_columns{{
+	{0x00, 0x00, 0x00, 0x00, 0x00}, /* */
+	{0x00, 0x00, 0x5f, 0x00, 0x00}, /*!*/
+	{0x00, 0x07, 0x00, 0x07, 0x00}, /*"*/
+	{0x14, 0x7f, 0x14, 0x7f, 0x14}, /*#*/
+	{0x24, 0x2a, 0x7f, 0x2a, 0x12}, /*$*/
+	{0x23, 0x13, 0x08, 0x64, 0x62}, /*%*/
+	{0x36, 0x49, 0x55, 0x22, 0x50}, /*&*/
+	{0x00, 0x05, 0x03, 0x00, 0x00}, /*'*/
+	{0x00, 0x1c, 0x22, 0x41, 0x00}, /*(*/
+	{0x00, 0x41, 0x22, 0x1c, 0x00}, /*)*/
+	{0x08, 0x2a, 0x1c, 0x2a, 0x08}, /***/
+	{0x08, 0x08, 0x3e, 0x08, 0x08}, /*+*/
+	{0x00, 0x50, 0x30, 0x00, 0x00}, /*,*/
+	{0x08, 0x08, 0x08, 0x08, 0x08}, /*-*/
+	{0x00, 0x60, 0x60, 0x00, 0x00}, /*.*/
+	{0x20, 0x10, 0x08, 0x04, 0x02}, /*/*/
+	{0x3e, 0x51, 0x49, 0x45, 0x3e}, /*0*/
+	{0x00, 0x42, 0x7f, 0x40, 0x00}, /*1*/
+	{0x42, 0x61, 0x51, 0x49, 0x46}, /*2*/
+	{0x21, 0x41, 0x45, 0x4b, 0x31}, /*3*/
+	{0x18, 0x14, 0x12, 0x7f, 0x10}, /*4*/
+	{0x27, 0x45, 0x45, 0x45, 0x39}, /*5*/
+	{0x3c, 0x4a, 0x49, 0x49, 0x30}, /*6*/
+	{0x01, 0x71, 0x09, 0x05, 0x03}, /*7*/
+	{0x36, 0x49, 0x49, 0x49, 0x36}, /*8*/
+	{0x06, 0x49, 0x49, 0x29, 0x1e}, /*9*/
+	{0x00, 0x36, 0x36, 0x00, 0x00}, /*:*/
+	{0x00, 0x56, 0x36, 0x00, 0x00}, /*;*/
+	{0x08, 0x14, 0x22, 0x41, 0x00}, /*<*/
+	{0x14, 0x14, 0x14, 0x14, 0x14}, /*=*/
+	{0x00, 0x41, 0x22, 0x14, 0x08}, /*>*/
+	{0x02, 0x01, 0x51, 0x09, 0x06}, /*?*/
+	{0x32, 0x49, 0x79, 0x41, 0x3e}, /*@*/
+	{0x7e, 0x11, 0x11, 0x11, 0x7e}, /*A*/
+	{0x7f, 0x49, 0x49, 0x49, 0x36}, /*B*/
+	{0x3e, 0x41, 0x41, 0x41, 0x22}, /*C*/
+	{0x7f, 0x41, 0x41, 0x22, 0x1c}, /*D*/
+	{0x7f, 0x49, 0x49, 0x49, 0x41}, /*E*/
+	{0x7f, 0x09, 0x09, 0x09, 0x01}, /*F*/
+	{0x3e, 0x41, 0x49, 0x49, 0x7a}, /*G*/
+	{0x7f, 0x08, 0x08, 0x08, 0x7f}, /*H*/
+	{0x00, 0x41, 0x7f, 0x41, 0x00}, /*I*/
+	{0x20, 0x40, 0x41, 0x3f, 0x01}, /*J*/
+	{0x7f, 0x08, 0x14, 0x22, 0x41}, /*K*/
+	{0x7f, 0x40, 0x40, 0x40, 0x40}, /*L*/
+	{0x7f, 0x02, 0x0c, 0x02, 0x7f}, /*M*/
+	{0x7f, 0x04, 0x08, 0x10, 0x7f}, /*N*/
+	{0x3e, 0x41, 0x41, 0x41, 0x3e}, /*O*/
+	{0x7f, 0x09, 0x09, 0x09, 0x06}, /*P*/
+	{0x3e, 0x41, 0x51, 0x21, 0x5e}, /*Q*/
+	{0x7f, 0x09, 0x19, 0x29, 0x46}, /*R*/
+	{0x46, 0x49, 0x49, 0x49, 0x31}, /*S*/
+	{0x01, 0x01, 0x7f, 0x01, 0x01}, /*T*/
+	{0x3f, 0x40, 0x40, 0x40, 0x3f}, /*U*/
+	{0x1f, 0x20, 0x40, 0x20, 0x1f}, /*V*/
+	{0x3f, 0x40, 0x38, 0x40, 0x3f}, /*W*/
+	{0x63, 0x14, 0x08, 0x14, 0x63}, /*X*/
+	{0x07, 0x08, 0x70, 0x08, 0x07}, /*Y*/
+	{0x61, 0x51, 0x49, 0x45, 0x43}, /*Z*/
+	{0x00, 0x7f, 0x41, 0x41, 0x00}, /*[*/
+	{0x02, 0x04, 0x08, 0x10, 0x20}, /*\*/
+	{0x00, 0x41, 0x41, 0x7f, 0x00}, /*]*/
+	{0x04, 0x02, 0x01, 0x02, 0x04}, /*^*/
+	{0x40, 0x40, 0x40, 0x40, 0x40}, /*_*/
+	{0x00, 0x01, 0x02, 0x04, 0x00}, /*`*/
+	{0x20, 0x54, 0x54, 0x54, 0x78}, /*a*/
+	{0x7f, 0x48, 0x44, 0x44, 0x38}, /*b*/
+	{0x38, 0x44, 0x44, 0x44, 0x20}, /*c*/
+	{0x38, 0x44, 0x44, 0x48, 0x7f}, /*d*/
+	{0x38, 0x54, 0x54, 0x54, 0x18}, /*e*/
+	{0x08, 0x7e, 0x09, 0x01, 0x02}, /*f*/
+	{0x0c, 0x52, 0x52, 0x52, 0x3e}, /*g*/
+	{0x7f, 0x08, 0x04, 0x04, 0x78}, /*h*/
+	{0x00, 0x44, 0x7d, 0x40, 0x00}, /*i*/
+	{0x20, 0x40, 0x44, 0x3d, 0x00}, /*j*/
+	{0x7f, 0x10, 0x28, 0x44, 0x00}, /*k*/
+	{0x00, 0x41, 0x7f, 0x40, 0x00}, /*l*/
+	{0x7c, 0x04, 0x18, 0x04, 0x78}, /*m*/
+	{0x7c, 0x08, 0x04, 0x04, 0x78}, /*n*/
+	{0x38, 0x44, 0x44, 0x44, 0x38}, /*o*/
+	{0x7c, 0x14, 0x14, 0x14, 0x08}, /*p*/
+	{0x08, 0x14, 0x14, 0x18, 0x7c}, /*q*/
+	{0x7c, 0x08, 0x04, 0x04, 0x08}, /*r*/
+	{0x48, 0x54, 0x54, 0x54, 0x20}, /*s*/
+	{0x04, 0x3f, 0x44, 0x40, 0x20}, /*t*/
+	{0x3c, 0x40, 0x40, 0x20, 0x7c}, /*u*/
+	{0x1c, 0x20, 0x40, 0x20, 0x1c}, /*v*/
+	{0x3c, 0x40, 0x30, 0x40, 0x3c}, /*w*/
+	{0x44, 0x28, 0x10, 0x28, 0x44}, /*x*/
+	{0x0c, 0x50, 0x50, 0x50, 0x3c}, /*y*/
+	{0x44, 0x64, 0x54, 0x4c, 0x44}, /*z*/
+	{0x00, 0x08, 0x36, 0x41, 0x00}, /*{*/
+	{0x00, 0x00, 0x7f, 0x00, 0x00}, /*|*/
+	{0x00, 0x41, 0x36, 0x08, 0x00}, /*}*/
+	{0x08, 0x04, 0x08, 0x10, 0x08}, /*~*/
+}};
+
+/**
+ * Glyph masks of one scale, a mask is all ones for pixels of the glyph
+ * and zero elsewhere, so a glyph row is stored with a single select.
+ * Rows are padded with zero masks to whole vectors, glyph i covers
+ * cell.height rows of stride masks starting at masks[i * stride * cell.height].
+ */
+struct GlyphAtlas
+{
+	uint32_t scale;
+	CanvasExtent cell;
+	uint32_t stride;
+	std::vector<uint32_t> masks;
+};
+
+[[nodiscard]]
+GlyphAtlas
+build_glyph_atlas(const uint32_t scale)
+{
+	GlyphAtlas atlas{};
+	atlas.scale = scale;
+	atlas.cell = CanvasExtent{font_cell_extent.width * scale, font_cell_extent.height * scale};
+	atlas.stride = (font_glyph_extent.width * scale + 3) & ~3u;
+	const size_t glyph_size = size_t{atlas.stride} * atlas.cell.height;
+	atlas.masks.assign(glyph_size * font_glyph_count, 0u);
+
+	for (uint32_t glyph = 0; glyph < font_glyph_count; glyph++) {
+		uint32_t* masks = atlas.masks.data() + glyph * glyph_size;
+		for (uint32_t y = 0; y < font_glyph_extent.height * scale; y++)
+			for (uint32_t x = 0; x < font_glyph_extent.width * scale; x++)
+				if ((font_5x7_columns[glyph][x / scale] >> (y / scale)) & 1)
+					masks[size_t{y} * atlas.stride + x] = ~0u;
+	}
+	return atlas;
+}
+
+/**
+ * The atlas of a scale is built the first time it is asked for and kept
+ * for the lifetime of the program.
+ */
+const GlyphAtlas&
+cached_glyph_atlas(const uint32_t scale)
+{
+	static std::mutex mutex{};
+	static std::map<uint32_t, std::unique_ptr<GlyphAtlas>> atlases{};
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& atlas = atlases[scale];
+	if (!atlas)
+		atlas = std::make_unique<GlyphAtlas>(build_glyph_atlas(scale));
+	return *atlas;
+}
+
+/*characters outside of the font are drawn as '?'*/
+[[nodiscard]]
+constexpr uint32_t
+glyph_index(const char c) noexcept
+{
+	if (c < font_first_glyph || c > font_last_glyph)
+		return '?' - font_first_glyph;
+	return static_cast<uint32_t>(c - font_first_glyph);
+}
+
+/**
+ * The extent of text at a scale, every line is a row of cells and lines
+ * are separated by '\n'.
+ */
+[[nodiscard]]
+CanvasExtent
+measure_text(const std::string_view text, const uint32_t scale) noexcept
+{
+	uint32_t lines = 1;
+	uint32_t longest = 0;
+	uint32_t line = 0;
+	for (const char c: text) {
+		if (c == '\n') {
+			lines++;
+			line = 0;
+			continue;
+		}
+		longest = std::max(longest, ++line);
+	}
+	return CanvasExtent{longest * font_cell_extent.width * scale,
+						lines * font_cell_extent.height * scale};
+}
+
+/**
+ * Store color into the pixels of a span whose mask is set, 8 (AVX2) or
+ * 4 (SSE2) pixels at a time with a scalar tail.
+ */
+void
+store_masked_span(Pixel8bitRGBA* dst,
+				  const uint32_t* masks,
+				  const size_t count,
+				  const Pixel8bitRGBA color) noexcept
+{
+	uint32_t pattern;
+	std::memcpy(&pattern, &color, sizeof(pattern));
+
+	size_t i = 0;
+#if defined(__AVX2__)
+	const __m256i color8 = _mm256_set1_epi32(static_cast<int>(pattern));
+	for (; i + 8 <= count; i += 8) {
+		const __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(masks + i));
+		_mm256_maskstore_epi32(reinterpret_cast<int*>(dst + i), mask, color8);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i color4 = _mm_set1_epi32(static_cast<int>(pattern));
+	for (; i + 4 <= count; i += 4) {
+		const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i));
+		if (_mm_movemask_epi8(mask) == 0)
+			continue;
+		const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+		const __m128i blended = _mm_or_si128(_mm_and_si128(mask, color4), _mm_andnot_si128(mask, d));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), blended);
+	}
+#endif
+	for (; i < count; i++) {
+		if (masks[i] != 0)
+			std::memcpy(dst + i, &pattern, sizeof(pattern));
+	}
+}
+
+/**
+ * Draw text with its top left corner at offset, overwriting the glyph
+ * pixels with color. Every destination row is visited once, writing that
+ * row of every glyph on it from left to right before moving on.
+ */
+CanvasView8bitRGBA
+draw_text(const Pixel8bitRGBA color,
+		  const CanvasOffset offset,
+		  const std::string_view text,
+		  const uint32_t scale,
+		  const CanvasView8bitRGBA view)
+{
+	if (scale == 0 || text.empty())
+		return view;
+
+	const GlyphAtlas& atlas = cached_glyph_atlas(scale);
+	const size_t glyph_size = size_t{atlas.stride} * atlas.cell.height;
+	const uint64_t view_width = view.extent.width;
+
+	size_t line_start = 0;
+	uint64_t line_y = offset.y;
+	while (line_start <= text.size() && line_y < view.extent.height) {
+		const size_t line_end = std::min(text.find('\n', line_start), text.size());
+		const std::string_view line = text.substr(line_start, line_end - line_start);
+
+		const uint64_t last_row = std::min<uint64_t>(line_y + atlas.cell.height, view.extent.height);
+		for (uint64_t y = line_y; y < last_row; y++) {
+			Pixel8bitRGBA* row = view.row(static_cast<uint32_t>(y)).data();
+			const size_t glyph_row = static_cast<size_t>(y - line_y) * atlas.stride;
+			uint64_t x = offset.x;
+			for (const char c: line) {
+				if (x >= view_width)
+					break;
+				const uint32_t* masks = atlas.masks.data() + glyph_index(c) * glyph_size + glyph_row;
+				const uint64_t count = std::min<uint64_t>(atlas.stride, view_width - x);
+				store_masked_span(row + x, masks, count, color);
+				x += atlas.cell.width;
+			}
+		}
+
+		line_start = line_end + 1;
+		line_y += atlas.cell.height;
+	}
+	return view;
+}
+
+Canvas8bitRGBA
+draw_text(const Pixel8bitRGBA color,
+		  const CanvasOffset offset,
+		  const std::string_view text,
+		  const uint32_t scale,
+		  Canvas8bitRGBA&& canvas)
+{
+	draw_text(color, offset, text, scale, as_view(canvas));
+	if (scale == 0 || text.empty())
+		return canvas;
+
+	if (const auto clipped = clip_rectangle(offset, measure_text(text, scale), canvas.extent))
+		mark_damaged(canvas, *clipped);
+	return canvas;
+}
+
+decltype(auto)
+draw_text(const Pixel8bitRGBA color,
+		  const CanvasOffset offset,
+		  const std::string_view text,
+		  const uint32_t scale = 1)
+{
+	return [=, text = std::string(text)] <CanvasPipelineArgument CanvasType> (CanvasType&& canvas)
+	{
+		return draw_text(color, offset, std::string_view(text), scale, std::forward<CanvasType>(canvas));
+	};
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+//#define VULKAN_HPP_NO_STRUCT_CONSTRUCTORS
+#include <vulkan/vulkan.hpp>
+
+#include "Utils.hpp"
+#include "Texture.hpp"
+
+/**
+ * A device without a window or surface, for the tests and benchmarks that
+ * only upload and copy. It sets up the same upload queue and staging ring
+ * as PresentationContext, so the same upload paths run on it, and works on
+ * software devices like lavapipe as well.
+ * The physical device is the first one with a graphics queue, unless
+ * device_index picks another one.
+ */
+class HeadlessContext
+{
+public:
+	explicit HeadlessContext(const std::optional<uint32_t> device_index = std::nullopt);
+	~HeadlessContext() = default;
+
+	vk::CommandPool& command_pool();
+	vk::Queue& graphics_queue();
+	StagingRing& staging_ring();
+	UploadQueue& upload_queue();
+
+	vk::UniqueInstance instance_;
+	vk::PhysicalDevice physical_device;
+	uint32_t graphics_index_{0};
+	/*a transfer only family, when the device has one*/
+	std::optional<uint32_t> transfer_index_;
+	vk::UniqueDevice device;
+	vk::Queue graphics_queue_;
+	vk::Queue transfer_queue_;
+
+	vk::UniqueCommandPool commandpool_;
+	vk::UniqueCommandPool transfer_commandpool_;
+	UploadQueue upload_queue_;
+	/*persistently mapped memory every upload is staged in*/
+	std::optional<StagingRing> staging_ring_;
+
+private:
+	void CreateInstance();
+	void GetPhysicalDevice(const std::optional<uint32_t> device_index);
+	void GetQueueFamilyIndices();
+	void CreateDevice();
+	void CreateQueues();
+	void CreateCommandpool();
+	void CreateStagingRing();
+};
+
+vk::CommandPool& HeadlessContext::command_pool()
+{
+	return commandpool_.get();
+}
+
+vk::Queue& HeadlessContext::graphics_queue()
+{
+	return graphics_queue_;
+}
+
+StagingRing& HeadlessContext::staging_ring()
+{
+	return *staging_ring_;
+}
+
+UploadQueue& HeadlessContext::upload_queue()
+{
+	return upload_queue_;
+}
+
+HeadlessContext::HeadlessContext(const std::optional<uint32_t> device_index)
+{
+	CreateInstance();
+	GetPhysicalDevice(device_index);
+	GetQueueFamilyIndices();
+	CreateDevice();
+	CreateQueues();
+	CreateCommandpool();
+	CreateStagingRing();
+}
+
+void HeadlessContext::CreateInstance()
+{
+	auto applicationInfo = vk::ApplicationInfo{}
+		.setPApplicationName("headless")
+		.setPEngineName("engine")
+		.setApplicationVersion(VK_MAKE_VERSION(1, 0, 0))
+		.setEngineVersion(VK_MAKE_VERSION(1, 0, 0))
+		.setApiVersion(VK_MAKE_VERSION(1, 0, 0));
+
+	/*validation is used when it is installed, but not required*/
+	std::vector<const char*> validation_layers{};
+	if (is_validation_layer_available("VK_LAYER_KHRONOS_validation"))
+		validation_layers.push_back("VK_LAYER_KHRONOS_validation");
+
+	auto instanceCreateInfo = vk::InstanceCreateInfo{}
+		.setPApplicationInfo(&applicationInfo)
+		.setPEnabledLayerNames(validation_layers);
+
+	instance_ = vk::createInstanceUnique(instanceCreateInfo);
+}
+
+void HeadlessContext::GetPhysicalDevice(const std::optional<uint32_t> device_index)
+{
+	const std::vector<vk::PhysicalDevice> devices = instance_->enumeratePhysicalDevices();
+	if (device_index) {
+		if (*device_index >= devices.size())
+			throw std::runtime_error("No physical device with the requested index");
+		physical_device = devices[*device_index];
+	}
+	else {
+		const auto found = std::ranges::find_if(devices, [] (const vk::PhysicalDevice& device)
+		{
+			return !get_all_graphics_queue_family_indices(device).empty();
+		});
+		if (found == devices.end())
+			throw std::runtime_error("No physical device with a graphics queue");
+		physical_device = *found;
+	}
+
+	std::cout << "> Headless on " << physical_device.getProperties().deviceName << std::endl;
+}
+
+void HeadlessContext::GetQueueFamilyIndices()
+{
+	const auto graphics_indices = get_all_graphics_queue_family_indices(physical_device);
+	if (graphics_indices.empty())
+		throw std::runtime_error("could not get a graphics index");
+
+	graphics_index_ = graphics_indices.front();
+	transfer_index_ = get_dedicated_transfer_queue_family_index(physical_device);
+}
+
+void HeadlessContext::CreateDevice()
+{
+	float queuePriority = 1.0f;
+
+	std::vector<uint32_t> families{graphics_index_};
+	if (transfer_index_)
+		families.push_back(*transfer_index_);
+
+	std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos{};
+	for (const auto family: families)
+		deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo{}
+										 .setFlags({})
+										 .setQueueFamilyIndex(family)
+										 .setPQueuePriorities(&queuePriority)
+										 .setQueueCount(1));
+
+	auto deviceCreateInfo = vk::DeviceCreateInfo{}
+		.setQueueCreateInfos(deviceQueueCreateInfos);
+
+	device = physical_device.createDeviceUnique(deviceCreateInfo);
+}
+
+void HeadlessContext::CreateQueues()
+{
+	graphics_queue_ = device->getQueue(graphics_index_, 0);
+	if (transfer_index_)
+		transfer_queue_ = device->getQueue(*transfer_index_, 0);
+}
+
+void HeadlessContext::CreateCommandpool()
+{
+	auto commandPoolCreateInfo = vk::CommandPoolCreateInfo{}
+		.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+		.setQueueFamilyIndex(graphics_index_);
+	commandpool_ = device->createCommandPoolUnique(commandPoolCreateInfo, nullptr);
+
+	upload_queue_.graphics_command_pool = commandpool_.get();
+	upload_queue_.graphics_queue = graphics_queue_;
+	upload_queue_.graphics_family = graphics_index_;
+	if (transfer_index_) {
+		auto transferPoolCreateInfo = vk::CommandPoolCreateInfo{}
+			.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+			.setQueueFamilyIndex(*transfer_index_);
+		transfer_commandpool_ = device->createCommandPoolUnique(transferPoolCreateInfo, nullptr);
+		upload_queue_.command_pool = transfer_commandpool_.get();
+		upload_queue_.queue = transfer_queue_;
+		upload_queue_.family = *transfer_index_;
+	}
+	else {
+		upload_queue_.command_pool = commandpool_.get();
+		upload_queue_.queue = graphics_queue_;
+		upload_queue_.family = graphics_index_;
+	}
+}
+
+void HeadlessContext::CreateStagingRing()
+{
+	staging_ring_.emplace(physical_device, device.get(), staging_ring_default_capacity);
+}
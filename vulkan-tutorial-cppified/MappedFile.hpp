@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <utility>
+#include <variant>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * A read only memory mapping of a whole file.
+ * The bytes are read straight from the page cache, and the mapping is
+ * hinted as sequential so the kernel reads ahead aggressively.
+ */
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	/*takes ownership of a mapping made with mmap*/
+	MappedFile(void* data, const size_t size) noexcept;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& rhs) noexcept;
+	MappedFile& operator=(MappedFile&& rhs) noexcept;
+
+	uint8_t const* data() const noexcept { return data_; }
+	size_t size() const noexcept { return size_; }
+	std::span<const uint8_t> bytes() const noexcept { return {data_, size_}; }
+
+private:
+	uint8_t const* data_{nullptr};
+	size_t size_{0};
+};
+
+MappedFile::MappedFile(void* data, const size_t size) noexcept
+	: data_(static_cast<uint8_t const*>(data))
+	, size_(size)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	if (data_ != nullptr)
+		munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) noexcept
+{
+	std::swap(data_, rhs.data_);
+	std::swap(size_, rhs.size_);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) noexcept
+{
+	std::swap(data_, rhs.data_);
+	std::swap(size_, rhs.size_);
+	return *this;
+}
+
+/*errno of the failed open, stat or mmap*/
+struct MapFileError
+{
+	int error{0};
+};
+
+/**
+ * Map a file for reading. The file descriptor is closed right away, the
+ * mapping keeps the file contents alive on its own.
+ * Empty files can not be mapped and fail with EINVAL.
+ */
+std::variant<MappedFile, MapFileError>
+map_file(const std::filesystem::path& path) noexcept
+{
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return MapFileError{errno};
+
+	struct stat status{};
+	if (fstat(fd, &status) != 0) {
+		const int error = errno;
+		close(fd);
+		return MapFileError{error};
+	}
+	if (status.st_size <= 0) {
+		close(fd);
+		return MapFileError{EINVAL};
+	}
+
+	const auto size = static_cast<size_t>(status.st_size);
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	const int error = errno;
+	close(fd);
+	if (data == MAP_FAILED)
+		return MapFileError{error};
+
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	return MappedFile(data, size);
+}
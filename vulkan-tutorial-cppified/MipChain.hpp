@@ -0,0 +1,362 @@
+#pragma once
+
+#include "Bitmap.hpp"
+#include "Canvas.hpp"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/**
+ * Mip chains built on the cpu.
+ * Every level halves the previous one (rounding down, never below 1) until
+ * a 1x1 level is reached. All levels are packed into one allocation, level 0
+ * first, so the whole chain goes to the gpu through a single staging buffer.
+ *
+ * The filters treat the 4 channels alike, so the same kernels serve both
+ * RGBA and BGRA pixels, which are both stored as Pixel8bitRGBA here.
+ */
+enum class MipFilter
+{
+	Box,
+	Kaiser,
+};
+
+struct MipLevel
+{
+	CanvasExtent extent;
+	/*offset of the first pixel of the level from the start of the chain*/
+	size_t offset;
+};
+
+struct MipChain
+{
+	vk::Format format;
+	std::vector<MipLevel> levels;
+	std::vector<Pixel8bitRGBA> pixels;
+};
+
+[[nodiscard]]
+constexpr CanvasExtent
+next_mip_extent(const CanvasExtent extent) noexcept
+{
+	return CanvasExtent{std::max(extent.width / 2, 1u),
+		                std::max(extent.height / 2, 1u)};
+}
+
+[[nodiscard]]
+constexpr uint32_t
+mip_level_count(CanvasExtent extent) noexcept
+{
+	uint32_t count = 1;
+	while (extent.width > 1 || extent.height > 1) {
+		extent = next_mip_extent(extent);
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Average 2x2 blocks into the rows of band, exactly rounded.
+ * A source of width or height 1 repeats its only column or row.
+ */
+void
+downsample_box(const Pixel8bitRGBA* src,
+			   const CanvasExtent src_extent,
+			   Pixel8bitRGBA* dst,
+			   const CanvasExtent dst_extent,
+			   const CanvasRect band) noexcept
+{
+	const uint32_t step_x = src_extent.width > 1 ? 1 : 0;
+	for (uint32_t y = band.offset.y; y < band.offset.y + band.extent.height; y++) {
+		const Pixel8bitRGBA* row0 = src + size_t{2 * y} * src_extent.width;
+		const Pixel8bitRGBA* row1 = src
+			+ size_t{std::min(2 * y + 1, src_extent.height - 1)} * src_extent.width;
+		Pixel8bitRGBA* out = dst + size_t{y} * dst_extent.width;
+
+		uint32_t x = 0;
+#if defined(__SSE2__)
+		if (step_x == 1) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i round = _mm_set1_epi16(2);
+			/*4 source pixels of both rows give 2 destination pixels*/
+			for (; x + 2 <= dst_extent.width; x += 2) {
+				const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * x));
+				const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * x));
+				const __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				const __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+				const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high),
+												  _mm_unpackhi_epi64(low, high));
+				const __m128i average = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(average, zero));
+			}
+		}
+#endif
+		for (; x < dst_extent.width; x++) {
+			const Pixel8bitRGBA p[4] = {row0[2 * x], row0[2 * x + step_x],
+										row1[2 * x], row1[2 * x + step_x]};
+			const auto average = [&] (const auto channel) -> uint8_t
+			{
+				return static_cast<uint8_t>((uint32_t{p[0].*channel} + p[1].*channel
+											 + p[2].*channel + p[3].*channel + 2) >> 2);
+			};
+			out[x] = Pixel8bitRGBA{average(&Pixel8bitRGBA::r),
+				                   average(&Pixel8bitRGBA::g),
+				                   average(&Pixel8bitRGBA::b),
+				                   average(&Pixel8bitRGBA::a)};
+		}
+	}
+}
+
+/*taps on either side of the center of a Kaiser filtered destination pixel*/
+constexpr int32_t kaiser_half_taps = 3;
+
+/**
+ * Kaiser windowed sinc weights for halving, the taps sit 0.5, 1.5 and 2.5
+ * source pixels from the destination pixel center on either side.
+ */
+[[nodiscard]]
+const std::array<float, 2 * kaiser_half_taps>&
+kaiser_weights() noexcept
+{
+	static const auto weights = [] ()
+	{
+		constexpr double alpha = 4.0;
+		const auto bessel_i0 = [] (const double x)
+		{
+			double sum = 1.0;
+			double term = 1.0;
+			for (int k = 1; k < 32; k++) {
+				term *= (x / (2.0 * k)) * (x / (2.0 * k));
+				sum += term;
+			}
+			return sum;
+		};
+
+		std::array<float, 2 * kaiser_half_taps> taps{};
+		double total = 0.0;
+		std::array<double, 2 * kaiser_half_taps> exact{};
+		for (int32_t i = 0; i < 2 * kaiser_half_taps; i++) {
+			const double distance = std::abs(i - kaiser_half_taps + 0.5);
+			const double t = distance / kaiser_half_taps;
+			const double sinc_x = 3.14159265358979323846 * distance / 2.0;
+			const double sinc = std::sin(sinc_x) / sinc_x;
+			exact[i] = sinc * bessel_i0(alpha * std::sqrt(1.0 - t * t)) / bessel_i0(alpha);
+			total += exact[i];
+		}
+		for (size_t i = 0; i < taps.size(); i++)
+			taps[i] = static_cast<float>(exact[i] / total);
+		return taps;
+	}();
+	return weights;
+}
+
+/**
+ * The horizontal pass of the Kaiser filter over the source rows of band,
+ * into half width rows of 4 floats per pixel.
+ */
+void
+downsample_kaiser_rows(const Pixel8bitRGBA* src,
+					   const CanvasExtent src_extent,
+					   float* dst,
+					   const uint32_t dst_width,
+					   const CanvasRect band) noexcept
+{
+	const auto& weights = kaiser_weights();
+	const int32_t last_x = static_cast<int32_t>(src_extent.width) - 1;
+	for (uint32_t y = band.offset.y; y < band.offset.y + band.extent.height; y++) {
+		const Pixel8bitRGBA* row = src + size_t{y} * src_extent.width;
+		float* out = dst + size_t{y} * dst_width * 4;
+		for (uint32_t x = 0; x < dst_width; x++) {
+			const int32_t first = static_cast<int32_t>(2 * x) - kaiser_half_taps + 1;
+#if defined(__SSE2__)
+			__m128 sum = _mm_setzero_ps();
+			for (int32_t t = 0; t < 2 * kaiser_half_taps; t++) {
+				int32_t pattern;
+				std::memcpy(&pattern, &row[std::clamp(first + t, 0, last_x)], sizeof(pattern));
+				const __m128i bytes = _mm_cvtsi32_si128(pattern);
+				const __m128i zero = _mm_setzero_si128();
+				const __m128 pixel = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+				sum = _mm_add_ps(sum, _mm_mul_ps(pixel, _mm_set1_ps(weights[t])));
+			}
+			_mm_storeu_ps(out + size_t{x} * 4, sum);
+#else
+			float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+			for (int32_t t = 0; t < 2 * kaiser_half_taps; t++) {
+				const Pixel8bitRGBA p = row[std::clamp(first + t, 0, last_x)];
+				sum[0] += p.r * weights[t];
+				sum[1] += p.g * weights[t];
+				sum[2] += p.b * weights[t];
+				sum[3] += p.a * weights[t];
+			}
+			std::memcpy(out + size_t{x} * 4, sum, sizeof(sum));
+#endif
+		}
+	}
+}
+
+/**
+ * The vertical pass of the Kaiser filter, from the horizontally filtered
+ * rows into the rows of band, rounded and clamped back to 8bit.
+ */
+void
+downsample_kaiser_columns(const float* src,
+						  const uint32_t src_height,
+						  Pixel8bitRGBA* dst,
+						  const CanvasExtent dst_extent,
+						  const CanvasRect band) noexcept
+{
+	const auto& weights = kaiser_weights();
+	const int32_t last_y = static_cast<int32_t>(src_height) - 1;
+	const size_t row_floats = size_t{dst_extent.width} * 4;
+	for (uint32_t y = band.offset.y; y < band.offset.y + band.extent.height; y++) {
+		const int32_t first = static_cast<int32_t>(2 * y) - kaiser_half_taps + 1;
+		const float* rows[2 * kaiser_half_taps];
+		for (int32_t t = 0; t < 2 * kaiser_half_taps; t++)
+			rows[t] = src + std::clamp(first + t, 0, last_y) * row_floats;
+
+		Pixel8bitRGBA* out = dst + size_t{y} * dst_extent.width;
+		for (uint32_t x = 0; x < dst_extent.width; x++) {
+#if defined(__SSE2__)
+			__m128 sum = _mm_setzero_ps();
+			for (int32_t t = 0; t < 2 * kaiser_half_taps; t++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[t] + size_t{x} * 4),
+												 _mm_set1_ps(weights[t])));
+			/*cvtps rounds to nearest, the packs saturate to [0, 255]*/
+			const __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(sum), _mm_setzero_si128());
+			const int32_t pattern = _mm_cvtsi128_si32(_mm_packus_epi16(words, _mm_setzero_si128()));
+			std::memcpy(&out[x], &pattern, sizeof(pattern));
+#else
+			float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+			for (int32_t t = 0; t < 2 * kaiser_half_taps; t++)
+				for (size_t c = 0; c < 4; c++)
+					sum[c] += rows[t][size_t{x} * 4 + c] * weights[t];
+			const auto channel = [&] (const size_t c)
+			{
+				return static_cast<uint8_t>(std::clamp(std::nearbyint(sum[c]), 0.0f, 255.0f));
+			};
+			out[x] = Pixel8bitRGBA{channel(0), channel(1), channel(2), channel(3)};
+#endif
+		}
+	}
+}
+
+/**
+ * Build every level below level 0, which must already be in place.
+ * Levels depend on each other, so they are built one after another with
+ * the rows of each level split across the canvas thread pool.
+ */
+void
+build_mip_levels(MipChain& chain, const MipFilter filter)
+{
+	std::vector<float> filtered_rows{};
+	for (size_t level = 1; level < chain.levels.size(); level++) {
+		const MipLevel& source = chain.levels[level - 1];
+		const MipLevel& destination = chain.levels[level];
+		const Pixel8bitRGBA* src = chain.pixels.data() + source.offset;
+		Pixel8bitRGBA* dst = chain.pixels.data() + destination.offset;
+		const auto whole = CanvasRect{CanvasOffset{0, 0}, destination.extent};
+
+		if (filter == MipFilter::Box) {
+			for_each_canvas_band(whole, [&] (const CanvasRect band)
+			{
+				downsample_box(src, source.extent, dst, destination.extent, band);
+			});
+			continue;
+		}
+
+		filtered_rows.resize(size_t{destination.extent.width} * source.extent.height * 4);
+		const auto rows = CanvasRect{CanvasOffset{0, 0},
+			                         CanvasExtent{destination.extent.width, source.extent.height}};
+		for_each_canvas_band(rows, [&] (const CanvasRect band)
+		{
+			downsample_kaiser_rows(src, source.extent, filtered_rows.data(),
+								   destination.extent.width, band);
+		});
+		for_each_canvas_band(whole, [&] (const CanvasRect band)
+		{
+			downsample_kaiser_columns(filtered_rows.data(), source.extent.height,
+									  dst, destination.extent, band);
+		});
+	}
+}
+
+/*build every level down to 1x1*/
+constexpr uint32_t all_mip_levels = std::numeric_limits<uint32_t>::max();
+
+/**
+ * Lay out the levels of a chain for a level 0 of extent, stopping early
+ * after max_levels levels, and leaving level 0 for the caller to fill.
+ */
+[[nodiscard]]
+MipChain
+allocate_mip_chain(const CanvasExtent extent,
+				   const vk::Format format,
+				   const uint32_t max_levels = all_mip_levels)
+{
+	MipChain chain{};
+	chain.format = format;
+	chain.levels.reserve(std::min(mip_level_count(extent), max_levels));
+
+	size_t offset = 0;
+	CanvasExtent level = extent;
+	while (true) {
+		chain.levels.push_back(MipLevel{level, offset});
+		offset += size_t{level.width} * level.height;
+		if ((level.width == 1 && level.height == 1) || chain.levels.size() >= max_levels)
+			break;
+		level = next_mip_extent(level);
+	}
+	chain.pixels.resize(offset);
+	return chain;
+}
+
+[[nodiscard]]
+MipChain
+build_mip_chain(const Canvas8bitRGBA& canvas,
+				const MipFilter filter = MipFilter::Box,
+				const uint32_t max_levels = all_mip_levels)
+{
+	if (canvas.extent.width == 0 || canvas.extent.height == 0)
+		throw std::runtime_error("Can not build a mip chain of an empty canvas...");
+
+	MipChain chain = allocate_mip_chain(canvas.extent, PixelFormatRGBA8::vulkan_format, max_levels);
+	std::copy(canvas.pixels.begin(), canvas.pixels.end(), chain.pixels.begin());
+	build_mip_levels(chain, filter);
+	return chain;
+}
+
+[[nodiscard]]
+MipChain
+build_mip_chain(const LoadedBitmap2D& bitmap,
+				const MipFilter filter = MipFilter::Box,
+				const uint32_t max_levels = all_mip_levels)
+{
+	if (bitmap.width <= 0 || bitmap.height <= 0)
+		throw std::runtime_error("Can not build a mip chain of an empty bitmap...");
+
+	const auto extent = CanvasExtent{static_cast<uint32_t>(bitmap.width),
+		                             static_cast<uint32_t>(bitmap.height)};
+	const size_t count = size_t{extent.width} * extent.height;
+	const vk::Format format = bitmap.format == BitmapPixelFormat::BGRA
+		? PixelFormatBGRA8::vulkan_format
+		: PixelFormatRGBA8::vulkan_format;
+
+	MipChain chain = allocate_mip_chain(extent, format, max_levels);
+	auto* level0 = reinterpret_cast<uint8_t*>(chain.pixels.data());
+	if (bitmap.format == BitmapPixelFormat::RGB)
+		expand_rgb_to_rgba(bitmap.pixels, level0, count);
+	else
+		std::memcpy(level0, bitmap.pixels, count * sizeof(Pixel8bitRGBA));
+	build_mip_levels(chain, filter);
+	return chain;
+}
+
+decltype(auto)
+build_mip_chain(const MipFilter filter)
+{
+	return [=] (const auto& image)
+	{
+		return build_mip_chain(image, filter);
+	};
+}
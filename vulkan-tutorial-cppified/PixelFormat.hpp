@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <bit>
+#include <concepts>
+#include <cstdint>
+
+struct Pixel8bitR
+{
+	uint8_t r;
+};
+
+struct Pixel8bitRG
+{
+	uint8_t r;
+	uint8_t g;
+};
+
+struct Pixel8bitRGBA
+{
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+	uint8_t a;
+};
+
+struct Pixel8bitBGRA
+{
+	uint8_t b;
+	uint8_t g;
+	uint8_t r;
+	uint8_t a;
+};
+
+/*channels are IEEE 754 half floats stored as raw bits*/
+struct Pixel16bitFloatRGBA
+{
+	uint16_t r;
+	uint16_t g;
+	uint16_t b;
+	uint16_t a;
+};
+
+/**
+ * Compile time pixel formats.
+ * Every format names its pixel storage and the vulkan format the pixels
+ * are uploaded as, so no runtime format branching is needed anywhere.
+ */
+struct PixelFormatR8
+{
+	using Pixel = Pixel8bitR;
+	static constexpr vk::Format vulkan_format = vk::Format::eR8Unorm;
+};
+
+struct PixelFormatRG8
+{
+	using Pixel = Pixel8bitRG;
+	static constexpr vk::Format vulkan_format = vk::Format::eR8G8Unorm;
+};
+
+struct PixelFormatRGBA8
+{
+	using Pixel = Pixel8bitRGBA;
+	static constexpr vk::Format vulkan_format = vk::Format::eR8G8B8A8Srgb;
+};
+
+struct PixelFormatBGRA8
+{
+	using Pixel = Pixel8bitBGRA;
+	static constexpr vk::Format vulkan_format = vk::Format::eB8G8R8A8Srgb;
+};
+
+struct PixelFormatRGBA16F
+{
+	using Pixel = Pixel16bitFloatRGBA;
+	static constexpr vk::Format vulkan_format = vk::Format::eR16G16B16A16Sfloat;
+};
+
+template <typename Format>
+concept PixelFormat = requires {
+	typename Format::Pixel;
+	{ Format::vulkan_format } -> std::convertible_to<vk::Format>;
+} && std::is_trivially_copyable_v<typename Format::Pixel>;
+
+/**
+ * The format a pixel type belongs to, so canvases can be created from
+ * just a fill color.
+ */
+template <typename Pixel>
+struct PixelFormatOf;
+
+template <> struct PixelFormatOf<Pixel8bitR> { using type = PixelFormatR8; };
+template <> struct PixelFormatOf<Pixel8bitRG> { using type = PixelFormatRG8; };
+template <> struct PixelFormatOf<Pixel8bitRGBA> { using type = PixelFormatRGBA8; };
+template <> struct PixelFormatOf<Pixel8bitBGRA> { using type = PixelFormatBGRA8; };
+template <> struct PixelFormatOf<Pixel16bitFloatRGBA> { using type = PixelFormatRGBA16F; };
+
+template <typename Pixel>
+using PixelFormatOf_t = typename PixelFormatOf<Pixel>::type;
+
+/**
+ * Convert a float to half float bits, rounding to nearest even.
+ */
+[[nodiscard]]
+constexpr uint16_t
+float_to_half(const float value) noexcept
+{
+	const uint32_t bits = std::bit_cast<uint32_t>(value);
+	const uint32_t sign = (bits >> 16) & 0x8000;
+	const uint32_t exponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	if (exponent == 0xff)
+		return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+	const int32_t half_exponent = static_cast<int32_t>(exponent) - 127 + 15;
+	if (half_exponent >= 0x1f)
+		return static_cast<uint16_t>(sign | 0x7c00);
+
+	if (half_exponent <= 0) {
+		if (half_exponent < -10)
+			return static_cast<uint16_t>(sign);
+		mantissa |= 0x800000;
+		const uint32_t shift = static_cast<uint32_t>(14 - half_exponent);
+		uint32_t half_mantissa = mantissa >> shift;
+		const uint32_t remainder = mantissa & ((1u << shift) - 1);
+		const uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half_mantissa & 1)))
+			half_mantissa++;
+		return static_cast<uint16_t>(sign | half_mantissa);
+	}
+
+	uint32_t half = sign | (static_cast<uint32_t>(half_exponent) << 10) | (mantissa >> 13);
+	const uint32_t remainder = mantissa & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++;
+	return static_cast<uint16_t>(half);
+}
+
+[[nodiscard]]
+constexpr float
+half_to_float(const uint16_t half) noexcept
+{
+	const uint32_t sign = uint32_t{half & 0x8000u} << 16;
+	int32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+
+	if (exponent == 0x1f)
+		return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+
+	if (exponent == 0) {
+		if (mantissa == 0)
+			return std::bit_cast<float>(sign);
+		/*subnormal half, normalize it*/
+		exponent = 1;
+		while ((mantissa & 0x400) == 0) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		mantissa &= 0x3ff;
+	}
+
+	const auto float_exponent = static_cast<uint32_t>(exponent + 127 - 15);
+	return std::bit_cast<float>(sign | (float_exponent << 23) | (mantissa << 13));
+}
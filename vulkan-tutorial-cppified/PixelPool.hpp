@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+struct PixelPoolStats
+{
+	/*allocations served from retained memory*/
+	uint64_t hits{0};
+	/*allocations that had to go to the system allocator*/
+	uint64_t misses{0};
+	/*releases that were freed because retaining them would exceed the limit*/
+	uint64_t overflows{0};
+	size_t retained_bytes{0};
+	size_t retained_blocks{0};
+	size_t max_retained_bytes{0};
+
+	double hit_rate() const noexcept;
+};
+
+double
+PixelPoolStats::hit_rate() const noexcept
+{
+	const uint64_t total = hits + misses;
+	return total == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(total);
+}
+
+/**
+ * Size classed free lists of pixel memory.
+ * Released blocks are kept for the next allocation of the same class
+ * instead of going back to the system, so canvases that are recreated
+ * every frame reuse memory that is already paged in.
+ *
+ * The smallest class is a 4096 byte page, above it there are 4 classes
+ * per power of two, so a block larger than a page is never more than 25%
+ * larger than asked for. Classes are multiples of 1/4 of the power of two
+ * below them, like 5120 for 4097 bytes, not necessarily of a page.
+ * At most max_retained_bytes are kept, anything released beyond that is
+ * freed right away.
+ */
+class PixelPool
+{
+public:
+	explicit PixelPool(const size_t max_retained_bytes);
+	~PixelPool();
+	PixelPool(const PixelPool&) = delete;
+	PixelPool& operator=(const PixelPool&) = delete;
+
+	/*the bytes of a block, for bytes asked for*/
+	static size_t size_class(const size_t bytes) noexcept;
+
+	[[nodiscard]]
+	void* allocate(const size_t bytes);
+	/*bytes must be what the memory was allocated with*/
+	void release(void* memory, const size_t bytes) noexcept;
+
+	/*a lower limit frees retained blocks, largest first, until it is met*/
+	void set_max_retained_bytes(const size_t max_retained_bytes) noexcept;
+	/*free every retained block*/
+	void trim() noexcept;
+
+	PixelPoolStats stats() const;
+
+private:
+	void TrimTo(const size_t max_retained_bytes) noexcept;
+
+	static constexpr size_t min_class_ = 4096;
+	static constexpr std::align_val_t alignment_{64};
+
+	std::map<size_t, std::vector<void*>> free_lists_;
+	size_t max_retained_bytes_;
+	size_t retained_bytes_{0};
+	size_t retained_blocks_{0};
+	uint64_t hits_{0};
+	uint64_t misses_{0};
+	uint64_t overflows_{0};
+	mutable std::mutex mutex_;
+};
+
+PixelPool::PixelPool(const size_t max_retained_bytes)
+	: max_retained_bytes_(max_retained_bytes)
+{
+}
+
+PixelPool::~PixelPool()
+{
+	TrimTo(0);
+}
+
+size_t
+PixelPool::size_class(const size_t bytes) noexcept
+{
+	const size_t size = std::max(bytes, min_class_);
+	/*keep the top 3 bits, so each power of two is split into 4 classes*/
+	const int shift = static_cast<int>(std::bit_width(size - 1)) - 3;
+	return (((size - 1) >> shift) + 1) << shift;
+}
+
+void*
+PixelPool::allocate(const size_t bytes)
+{
+	if (bytes == 0)
+		return nullptr;
+
+	const size_t block = size_class(bytes);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto found = free_lists_.find(block);
+		if (found != free_lists_.end() && !found->second.empty()) {
+			void* memory = found->second.back();
+			found->second.pop_back();
+			retained_bytes_ -= block;
+			retained_blocks_--;
+			hits_++;
+			return memory;
+		}
+		misses_++;
+	}
+	return ::operator new(block, alignment_);
+}
+
+void
+PixelPool::release(void* memory, const size_t bytes) noexcept
+{
+	if (memory == nullptr)
+		return;
+
+	const size_t block = size_class(bytes);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (retained_bytes_ + block <= max_retained_bytes_) {
+			try {
+				free_lists_[block].push_back(memory);
+				retained_bytes_ += block;
+				retained_blocks_++;
+				return;
+			}
+			catch (const std::bad_alloc&) {
+			}
+		}
+		overflows_++;
+	}
+	::operator delete(memory, alignment_);
+}
+
+void
+PixelPool::set_max_retained_bytes(const size_t max_retained_bytes) noexcept
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	max_retained_bytes_ = max_retained_bytes;
+	TrimTo(max_retained_bytes);
+}
+
+void
+PixelPool::trim() noexcept
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	TrimTo(0);
+}
+
+PixelPoolStats
+PixelPool::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	PixelPoolStats stats{};
+	stats.hits = hits_;
+	stats.misses = misses_;
+	stats.overflows = overflows_;
+	stats.retained_bytes = retained_bytes_;
+	stats.retained_blocks = retained_blocks_;
+	stats.max_retained_bytes = max_retained_bytes_;
+	return stats;
+}
+
+/*mutex_ must be held, or the pool no longer shared*/
+void
+PixelPool::TrimTo(const size_t max_retained_bytes) noexcept
+{
+	for (auto list = free_lists_.rbegin(); list != free_lists_.rend(); ++list) {
+		while (retained_bytes_ > max_retained_bytes && !list->second.empty()) {
+			::operator delete(list->second.back(), alignment_);
+			list->second.pop_back();
+			retained_bytes_ -= list->first;
+			retained_blocks_--;
+		}
+	}
+}
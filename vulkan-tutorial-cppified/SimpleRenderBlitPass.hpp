@@ -2,6 +2,7 @@
 
 #include <filesystem>
 #include "Texture.hpp"
+#include "TextureStreamer.hpp"
 
 struct SimpleRenderBlitFramePass
 {
@@ -14,6 +15,9 @@ struct SimpleRenderBlitPass
 {
 	bool debug_print;
 	Texture2D draw_texture;
+	/*when set, draw_texture is replaced by the streamed texture*/
+	TextureStreamer* streamer{nullptr};
+	StreamedTextureHandle streamed_draw_texture{0};
 	vk::UniqueRenderPass renderpass;
 	vk::UniquePipelineLayout pipeline_layout;
     vk::Pipeline pipeline;
@@ -34,6 +38,15 @@ generate_next_frame(SimpleRenderBlitPass& pass,
 		.setWidth(frame_pass.rendertarget.extent.width) 
 		.setHeight(frame_pass.rendertarget.extent.height); 
 
+	/*marks the streamed texture as used by this frame, it is not drawn
+	  until it is resident*/
+	Texture2D* draw_texture = pass.streamer != nullptr
+		? pass.streamer->use(pass.streamed_draw_texture)
+		: &pass.draw_texture;
+	const vk::Extent3D draw_extent = pass.streamer != nullptr
+		? pass.streamer->extent(pass.streamed_draw_texture)
+		: pass.draw_texture.extent;
+
 	const float flash = std::abs(std::sin(total_frames / 120.f));
 	const auto renderpass_initial_clear_color = vk::ClearValue{}
 		.setColor({0.0f, 0.0f, flash, 1.0f});
@@ -89,32 +102,49 @@ generate_next_frame(SimpleRenderBlitPass& pass,
 		 *   This means we can just blit to it directly afterwards.
 		 */
 
-		if (true) {
-			auto src_dst_subresource = vk::ImageSubresourceLayers{}
+		if (draw_texture != nullptr) {
+			/*a texture with dropped levels is blitted over the same area*/
+			const uint32_t dst_width = draw_extent.width / 3;
+			const uint32_t dst_height = draw_extent.height / 3;
+
+			/*blit from the smallest mip level still covering the destination, so
+			  the minification does not skip over source pixels*/
+			uint32_t src_level = 0;
+			while (src_level + 1 < draw_texture->mip_levels
+				   && (draw_texture->extent.width >> (src_level + 1)) >= dst_width
+				   && (draw_texture->extent.height >> (src_level + 1)) >= dst_height)
+				src_level++;
+
+			auto src_subresource = vk::ImageSubresourceLayers{}
+				.setAspectMask(vk::ImageAspectFlagBits::eColor)
+				.setBaseArrayLayer(0)
+				.setLayerCount(1)
+				.setMipLevel(src_level);
+			auto dst_subresource = vk::ImageSubresourceLayers{}
 				.setAspectMask(vk::ImageAspectFlagBits::eColor)
 				.setBaseArrayLayer(0)
 				.setLayerCount(1)
 				.setMipLevel(0);
 			const std::array<vk::Offset3D, 2> src_offsets{ 
 				vk::Offset3D(0, 0, 0),
-				vk::Offset3D(pass.draw_texture.extent.width,
-							 pass.draw_texture.extent.height,
+				vk::Offset3D(std::max(draw_texture->extent.width >> src_level, 1u),
+							 std::max(draw_texture->extent.height >> src_level, 1u),
 							 1)
 			};
 			const std::array<vk::Offset3D, 2> dst_offsets{ 
 				vk::Offset3D(0, 0, 0),
-				vk::Offset3D(pass.draw_texture.extent.width / 3,
-							 pass.draw_texture.extent.height / 3,
+				vk::Offset3D(dst_width,
+							 dst_height,
 							 1)
 			};
 			
 			auto image_blit = vk::ImageBlit{}
 				.setSrcOffsets(src_offsets)
-				.setSrcSubresource(src_dst_subresource)
+				.setSrcSubresource(src_subresource)
 				.setDstOffsets(dst_offsets)
-				.setDstSubresource(src_dst_subresource);
+				.setDstSubresource(dst_subresource);
 			
-			commandbuffer.blitImage(get_image(pass.draw_texture),
+			commandbuffer.blitImage(get_image(*draw_texture),
 									vk::ImageLayout::eTransferSrcOptimal,
 									get_image(frame_pass.rendertarget),
 									vk::ImageLayout::eTransferDstOptimal,
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * A region of host visible memory to write an upload into, copied from
+ * with buffer at offset.
+ */
+struct StagingAllocation
+{
+	vk::Buffer buffer;
+	vk::DeviceSize offset{0};
+	vk::DeviceSize size{0};
+	uint8_t* mapped{nullptr};
+};
+
+struct StagingRingStats
+{
+	/*allocations served from the ring*/
+	uint64_t ring_allocations{0};
+	/*allocations too large for the free space, given their own buffer*/
+	uint64_t dedicated_allocations{0};
+	/*times an allocation had to wait for the gpu to free up space*/
+	uint64_t fence_waits{0};
+	vk::DeviceSize used_bytes{0};
+	vk::DeviceSize capacity{0};
+};
+
+constexpr vk::DeviceSize staging_ring_default_capacity = vk::DeviceSize{64} << 20;
+
+/**
+ * One persistently mapped staging buffer that uploads sub allocate from,
+ * instead of every upload allocating, mapping and freeing its own.
+ *
+ * Allocations are handed out in order, wrapping around at the end.
+ * batch_fence() gives a fence to submit the copies reading them with, and
+ * close_batch() hands them over to it once the submission went through.
+ * When that fence has signaled their space is reused. The fence is shared
+ * with the submit tickets holding on to it, and only recycled once none
+ * do. When the ring is full an allocation first waits for the oldest
+ * batch, and only if that is not enough gets a dedicated buffer, freed
+ * with its batch.
+ *
+ * A batch covers every allocation made since the previous one, so the
+ * ring is not thread safe, uploads through it are staged and submitted
+ * from a single thread.
+ */
+class StagingRing
+{
+public:
+	StagingRing(vk::PhysicalDevice& physical_device,
+				vk::Device& device,
+				const vk::DeviceSize capacity);
+	~StagingRing();
+	StagingRing(const StagingRing&) = delete;
+	StagingRing& operator=(const StagingRing&) = delete;
+
+	/*offsets are aligned to alignment and to what buffer copies want*/
+	[[nodiscard]]
+	StagingAllocation allocate(const vk::DeviceSize size, const vk::DeviceSize alignment = 4);
+	[[nodiscard]]
+	StagingAllocation stage(void const* data,
+							const vk::DeviceSize size,
+							const vk::DeviceSize alignment = 4);
+
+	/*the fence to submit the allocations made since the last batch with,
+	  the same one until the batch is closed*/
+	[[nodiscard]]
+	std::shared_ptr<const vk::UniqueFence> batch_fence();
+	/*hand the open allocations over to the batch fence, once the submission
+	  with it went through. Allocations of a submission that failed stay
+	  open and are reclaimed with the next batch*/
+	void close_batch();
+	/*wait for a batch fence and reclaim what is done*/
+	void wait(const vk::Fence fence);
+	/*reclaim the space of every batch whose fence has signaled*/
+	void reclaim();
+	void wait_idle();
+
+	StagingRingStats stats() const;
+
+private:
+	struct Batch
+	{
+		std::shared_ptr<vk::UniqueFence> fence;
+		vk::DeviceSize end;
+		vk::DeviceSize bytes;
+		std::vector<AllocatedMemory> dedicated;
+	};
+
+	bool TryAllocate(const vk::DeviceSize size,
+					 const vk::DeviceSize alignment,
+					 StagingAllocation& allocation) noexcept;
+	StagingAllocation AllocateDedicated(const vk::DeviceSize size);
+	void RetireOldest();
+	void ReclaimSignaled();
+
+	vk::PhysicalDevice physical_device_;
+	vk::Device device_;
+	AllocatedMemory memory_;
+	uint8_t* mapped_{nullptr};
+	vk::DeviceSize capacity_;
+	vk::DeviceSize copy_alignment_;
+
+	/*next byte to hand out, and the oldest byte still in use*/
+	vk::DeviceSize head_{0};
+	vk::DeviceSize tail_{0};
+	/*bytes between tail_ and head_, padding included*/
+	vk::DeviceSize live_{0};
+
+	vk::DeviceSize open_bytes_{0};
+	std::vector<AllocatedMemory> open_dedicated_;
+	std::shared_ptr<vk::UniqueFence> open_fence_;
+	std::deque<Batch> pending_;
+	std::vector<vk::UniqueFence> free_fences_;
+
+	uint64_t ring_allocations_{0};
+	uint64_t dedicated_allocations_{0};
+	uint64_t fence_waits_{0};
+};
+
+StagingRing::StagingRing(vk::PhysicalDevice& physical_device,
+						 vk::Device& device,
+						 const vk::DeviceSize capacity)
+	: physical_device_(physical_device)
+	, device_(device)
+	, capacity_(std::max(capacity, vk::DeviceSize{4}))
+{
+	memory_ = allocate_memory(physical_device,
+							  device,
+							  capacity_,
+							  vk::BufferUsageFlagBits::eTransferSrc,
+							  vk::MemoryPropertyFlagBits::eHostVisible
+							  | vk::MemoryPropertyFlagBits::eHostCoherent);
+	mapped_ = static_cast<uint8_t*>(device.mapMemory(memory_.memory.get(),
+													 0,
+													 capacity_,
+													 vk::MemoryMapFlags()));
+	/*buffer to image copies need offsets that are multiples of 4*/
+	copy_alignment_ = std::lcm(vk::DeviceSize{4},
+							   std::max(vk::DeviceSize{1},
+										physical_device.getProperties()
+										.limits.optimalBufferCopyOffsetAlignment));
+}
+
+StagingRing::~StagingRing()
+{
+	/*a lost device has nothing left to wait for*/
+	try {
+		wait_idle();
+	}
+	catch (const std::exception&) {
+	}
+	device_.unmapMemory(memory_.memory.get());
+}
+
+StagingAllocation
+StagingRing::allocate(const vk::DeviceSize size, const vk::DeviceSize alignment)
+{
+	const vk::DeviceSize align = std::lcm(copy_alignment_, std::max(alignment, vk::DeviceSize{1}));
+
+	StagingAllocation allocation{};
+	if (size <= capacity_) {
+		ReclaimSignaled();
+		while (!TryAllocate(size, align, allocation)) {
+			if (pending_.empty())
+				return AllocateDedicated(size);
+			fence_waits_++;
+			RetireOldest();
+		}
+		ring_allocations_++;
+		return allocation;
+	}
+	return AllocateDedicated(size);
+}
+
+StagingAllocation
+StagingRing::stage(void const* data, const vk::DeviceSize size, const vk::DeviceSize alignment)
+{
+	StagingAllocation allocation = allocate(size, alignment);
+	memcpy(allocation.mapped, data, size);
+	return allocation;
+}
+
+std::shared_ptr<const vk::UniqueFence>
+StagingRing::batch_fence()
+{
+	if (open_fence_)
+		return open_fence_;
+	if (free_fences_.empty()) {
+		open_fence_ = std::make_shared<vk::UniqueFence>(device_.createFenceUnique(vk::FenceCreateInfo{}));
+	}
+	else {
+		open_fence_ = std::make_shared<vk::UniqueFence>(std::move(free_fences_.back()));
+		free_fences_.pop_back();
+	}
+	return open_fence_;
+}
+
+void
+StagingRing::close_batch()
+{
+	if (!open_fence_)
+		throw std::logic_error("closing a staging batch that was not submitted with its fence");
+
+	Batch batch{};
+	batch.fence = std::move(open_fence_);
+	open_fence_.reset();
+	batch.end = head_;
+	batch.bytes = open_bytes_;
+	batch.dedicated = std::move(open_dedicated_);
+	open_bytes_ = 0;
+	open_dedicated_.clear();
+	pending_.push_back(std::move(batch));
+}
+
+void
+StagingRing::wait(const vk::Fence fence)
+{
+	const auto waiting = std::ranges::find_if(pending_, [&] (const Batch& batch)
+	{
+		return batch.fence->get() == fence;
+	});
+	if (waiting == pending_.end())
+		return;
+
+	const auto waitresult = device_.waitForFences(fence,
+												  true,
+												  std::numeric_limits<uint64_t>::max());
+	if (waitresult != vk::Result::eSuccess)
+		throw std::runtime_error("Could not wait for staging fence");
+	ReclaimSignaled();
+}
+
+void
+StagingRing::reclaim()
+{
+	ReclaimSignaled();
+}
+
+void
+StagingRing::wait_idle()
+{
+	while (!pending_.empty())
+		RetireOldest();
+}
+
+StagingRingStats
+StagingRing::stats() const
+{
+	StagingRingStats stats{};
+	stats.ring_allocations = ring_allocations_;
+	stats.dedicated_allocations = dedicated_allocations_;
+	stats.fence_waits = fence_waits_;
+	stats.used_bytes = live_;
+	stats.capacity = capacity_;
+	return stats;
+}
+
+bool
+StagingRing::TryAllocate(const vk::DeviceSize size,
+						 const vk::DeviceSize alignment,
+						 StagingAllocation& allocation) noexcept
+{
+	const auto align_up = [alignment] (const vk::DeviceSize offset)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	};
+
+	vk::DeviceSize offset = align_up(head_);
+	const bool wrapped = head_ < tail_ || (head_ == tail_ && live_ > 0);
+	if (wrapped) {
+		if (offset + size > tail_)
+			return false;
+	}
+	else if (offset + size > capacity_) {
+		/*skip the end of the buffer and continue from the start*/
+		offset = 0;
+		if (size > tail_)
+			return false;
+	}
+
+	const vk::DeviceSize consumed = offset >= head_
+		? offset + size - head_
+		: capacity_ - head_ + size;
+	head_ = offset + size;
+	live_ += consumed;
+	open_bytes_ += consumed;
+
+	allocation.buffer = memory_.buffer.get();
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.mapped = mapped_ + offset;
+	return true;
+}
+
+StagingAllocation
+StagingRing::AllocateDedicated(const vk::DeviceSize size)
+{
+	AllocatedMemory dedicated = allocate_memory(physical_device_,
+												device_,
+												std::max(size, vk::DeviceSize{4}),
+												vk::BufferUsageFlagBits::eTransferSrc,
+												vk::MemoryPropertyFlagBits::eHostVisible
+												| vk::MemoryPropertyFlagBits::eHostCoherent);
+	StagingAllocation allocation{};
+	allocation.buffer = dedicated.buffer.get();
+	allocation.offset = 0;
+	allocation.size = size;
+	/*freeing the memory with its batch unmaps it*/
+	allocation.mapped = static_cast<uint8_t*>(device_.mapMemory(dedicated.memory.get(),
+																0,
+																VK_WHOLE_SIZE,
+																vk::MemoryMapFlags()));
+	open_dedicated_.push_back(std::move(dedicated));
+	dedicated_allocations_++;
+	return allocation;
+}
+
+void
+StagingRing::RetireOldest()
+{
+	Batch& oldest = pending_.front();
+	const auto waitresult = device_.waitForFences(oldest.fence->get(),
+												  true,
+												  std::numeric_limits<uint64_t>::max());
+	if (waitresult != vk::Result::eSuccess)
+		throw std::runtime_error("Could not wait for staging fence");
+
+	/*a fence a ticket still holds has to stay signaled for it*/
+	if (oldest.fence.use_count() == 1) {
+		device_.resetFences(oldest.fence->get());
+		free_fences_.push_back(std::move(*oldest.fence));
+	}
+	/*a batch without ring allocations does not move the tail*/
+	if (oldest.bytes > 0)
+		tail_ = oldest.end;
+	live_ -= oldest.bytes;
+	pending_.pop_front();
+
+	if (live_ == 0) {
+		head_ = 0;
+		tail_ = 0;
+	}
+}
+
+void
+StagingRing::ReclaimSignaled()
+{
+	while (!pending_.empty()
+		   && device_.getFenceStatus(pending_.front().fence->get()) == vk::Result::eSuccess)
+		RetireOldest();
+}
+
+/**
+ * Submit the commands recorded by f with the fence of the staging batch
+ * they read from, without waiting for it.
+ */
+[[nodiscard]]
+SubmitTicket
+with_buffer_submit_async(vk::Device& device,
+						 vk::CommandPool& command_pool,
+						 vk::Queue& queue,
+						 StagingRing& staging,
+						 std::function<void(vk::CommandBuffer&)>&& f,
+						 const bool signal_semaphore = false)
+{
+	auto buffer = beginSingleTimeCommands(device, command_pool);
+	f(buffer.get());
+	SubmitTicket ticket = submit_single_time_commands(device, queue, std::move(buffer),
+													  staging.batch_fence(), nullptr, signal_semaphore);
+	staging.close_batch();
+	return ticket;
+}
+
+void
+with_buffer_submit(vk::Device& device,
+				   vk::CommandPool& command_pool,
+				   vk::Queue& queue,
+				   StagingRing& staging,
+				   std::function<void(vk::CommandBuffer&)>&& f)
+{
+	with_buffer_submit_async(device, command_pool, queue, staging, std::move(f)).wait();
+}
+
+/**
+ * Submit an upload recorded by f on the upload queue with the staging
+ * batch fence, without waiting for it. With a dedicated transfer queue the
+ * handed over images are released there and acquired on the graphics
+ * queue, in a submission chained on the transfer with a semaphore, that
+ * also runs the commands recorded by on_graphics, like blits that the
+ * transfer queue can not do. The ticket is done when both are.
+ */
+[[nodiscard]]
+SubmitTicket
+with_upload_submit_async(vk::Device& device,
+						 UploadQueue& upload,
+						 StagingRing& staging,
+						 const std::span<const QueueFamilyHandover> handovers,
+						 std::function<void(vk::CommandBuffer&)>&& f,
+						 std::function<void(vk::CommandBuffer&)>&& on_graphics = {},
+						 const bool signal_semaphore = false)
+{
+	if (!upload.dedicated()) {
+		return with_buffer_submit_async(device, upload.graphics_command_pool, upload.graphics_queue,
+										staging,
+										[&] (vk::CommandBuffer& commandbuffer)
+										{
+											f(commandbuffer);
+											if (on_graphics)
+												on_graphics(commandbuffer);
+										},
+										signal_semaphore);
+	}
+
+	auto transfer = beginSingleTimeCommands(device, upload.command_pool);
+	f(transfer.get());
+	release_queue_family_ownership(handovers, upload.family, upload.graphics_family, transfer.get());
+	SubmitTicket transferred = submit_single_time_commands(device, upload.queue, std::move(transfer),
+														   staging.batch_fence(), nullptr, true);
+	staging.close_batch();
+
+	auto graphics = beginSingleTimeCommands(device, upload.graphics_command_pool);
+	acquire_queue_family_ownership(handovers, upload.family, upload.graphics_family, graphics.get());
+	if (on_graphics)
+		on_graphics(graphics.get());
+	auto fence = std::make_shared<const vk::UniqueFence>(device.createFenceUnique(vk::FenceCreateInfo{}));
+	return submit_single_time_commands(device, upload.graphics_queue, std::move(graphics),
+									   std::move(fence), &transferred, signal_semaphore);
+}
+
+void
+with_upload_submit(vk::Device& device,
+				   UploadQueue& upload,
+				   StagingRing& staging,
+				   const std::span<const QueueFamilyHandover> handovers,
+				   std::function<void(vk::CommandBuffer&)>&& f,
+				   std::function<void(vk::CommandBuffer&)>&& on_graphics = {})
+{
+	with_upload_submit_async(device, upload, staging, handovers,
+							 std::move(f), std::move(on_graphics)).wait();
+}
@@ -2,10 +2,19 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include "Utils.hpp"
 #include "Bitmap.hpp"
 #include "Canvas.hpp"
+#include "BitmapCache.hpp"
+#include "BlockCompression.hpp"
+#include "MipChain.hpp"
+#include "StagingRing.hpp"
 
 #include <iostream>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <utility>
 	
 struct Texture2D
 {
@@ -22,6 +31,7 @@ struct Texture2D
 	vk::Extent3D extent;
 	vk::Format format;
 	vk::ImageLayout layout;
+	uint32_t mip_levels{1};
 };
 
 Texture2D::Texture2D(Texture2D&& rhs) noexcept
@@ -30,6 +40,7 @@ Texture2D::Texture2D(Texture2D&& rhs) noexcept
 	std::swap(extent, rhs.extent);
 	std::swap(format, rhs.format);
 	std::swap(layout, rhs.layout);
+	std::swap(mip_levels, rhs.mip_levels);
 }
 
 Texture2D& Texture2D::operator=(Texture2D&& rhs) noexcept
@@ -38,6 +49,7 @@ Texture2D& Texture2D::operator=(Texture2D&& rhs) noexcept
 	std::swap(extent, rhs.extent);
 	std::swap(format, rhs.format);
 	std::swap(layout, rhs.layout);
+	std::swap(mip_levels, rhs.mip_levels);
 	return *this;
 }
 
@@ -54,19 +66,22 @@ create_empty_texture(vk::PhysicalDevice& physical_device,
 					 const vk::Extent3D extent,
 					 const vk::ImageTiling tiling,
 					 const vk::MemoryPropertyFlags propertyFlags,
-					 const vk::ImageUsageFlags usageFlags)
+					 const vk::ImageUsageFlags usageFlags,
+					 const uint32_t mip_levels = 1)
 {
 	Texture2D texture{};
 	texture.format = format;
 	texture.extent = extent;
 	texture.layout = vk::ImageLayout::eUndefined;
+	texture.mip_levels = mip_levels;
 	texture.allocated = allocate_image(physical_device,
 									   device,
 									   extent,
 									   format,
 									   tiling,
 									   propertyFlags,
-									   usageFlags);
+									   usageFlags,
+									   mip_levels);
 	return texture;
 }
 
@@ -76,7 +91,8 @@ create_empty_general_texture(vk::PhysicalDevice& physical_device,
 							 const vk::Format format,
 							 const vk::Extent3D extent,
 							 const vk::ImageTiling tiling,
-							 const vk::MemoryPropertyFlags propertyFlags)
+							 const vk::MemoryPropertyFlags propertyFlags,
+							 const uint32_t mip_levels = 1)
 {
 	return create_empty_texture(physical_device,
 								device,
@@ -86,7 +102,8 @@ create_empty_general_texture(vk::PhysicalDevice& physical_device,
 								propertyFlags,
 								vk::ImageUsageFlagBits::eTransferDst
 								| vk::ImageUsageFlagBits::eTransferSrc
-								| vk::ImageUsageFlagBits::eSampled);
+								| vk::ImageUsageFlagBits::eSampled,
+								mip_levels);
 }
 
 Texture2D
@@ -115,64 +132,526 @@ BitmapPixelFormatToVulkanFormat(const BitmapPixelFormat format) noexcept
 	switch (format) {	
 	case BitmapPixelFormat::RGBA:
 		return vk::Format::eR8G8B8A8Srgb;
+	/*few devices can sample 3 byte formats, RGB is expanded to RGBA on upload*/
+	case BitmapPixelFormat::RGB:
+		return vk::Format::eR8G8B8A8Srgb;
+	case BitmapPixelFormat::BGRA:
+		return vk::Format::eB8G8R8A8Srgb;
+	case BitmapPixelFormat::BC1:
+		return vk::Format::eBc1RgbSrgbBlock;
+	case BitmapPixelFormat::BC3:
+		return vk::Format::eBc3SrgbBlock;
+	case BitmapPixelFormat::BC7:
+		return vk::Format::eBc7SrgbBlock;
 	default:
 		break;
 	};
 	return vk::Format::eR8G8B8A8Srgb;
 }
 
+/**
+ * Pixels to upload into a new texture, pointing into a bitmap or canvas
+ * that has to outlive the upload. size is the staged size, in the format
+ * of the texture.
+ */
+struct TextureUploadSource
+{
+	void const* pixels;
+	vk::DeviceSize size;
+	vk::Extent3D extent;
+	vk::Format format;
+	vk::DeviceSize texel_size;
+	/*pixels are 3 byte RGB, expanded to the 4 byte format as they are staged*/
+	bool expand_rgb{false};
+};
+
+[[nodiscard]]
+TextureUploadSource
+texture_upload_source(const LoadedBitmap2D& bitmap) noexcept
+{
+	const bool expand_rgb = bitmap.format == BitmapPixelFormat::RGB;
+	const vk::DeviceSize texel_size = expand_rgb
+		? sizeof(Pixel8bitRGBA)
+		: BitmapPixelFormatBytesPerPixel(bitmap.format);
+	return TextureUploadSource{get_pixels(bitmap),
+							   texel_size * bitmap.width * bitmap.height,
+							   vk::Extent3D{static_cast<uint32_t>(bitmap.width),
+											static_cast<uint32_t>(bitmap.height),
+											1},
+							   BitmapPixelFormatToVulkanFormat(bitmap.format),
+							   texel_size,
+							   expand_rgb};
+}
+
+template <PixelFormat Format>
+[[nodiscard]]
+TextureUploadSource
+texture_upload_source(const Canvas<Format>& canvas) noexcept
+{
+	return TextureUploadSource{get_pixels(canvas),
+							   canvas.memory_size(),
+							   vk::Extent3D{canvas.extent.width, canvas.extent.height, 1},
+							   Format::vulkan_format,
+							   sizeof(typename Format::Pixel)};
+}
+
+/*write the pixels of source into the staging memory at dst*/
+void
+stage_upload_source(const TextureUploadSource& source, uint8_t* dst) noexcept
+{
+	if (source.expand_rgb)
+		expand_rgb_to_rgba(static_cast<const uint8_t*>(source.pixels),
+						   dst,
+						   size_t{source.extent.width} * source.extent.height);
+	else
+		memcpy(dst, source.pixels, source.size);
+}
+
+/**
+ * RGB bitmaps are expanded to RGBA straight into the staging memory.
+ */
 Texture2D
 copy_to_gpu(vk::PhysicalDevice& physical_device,
 			vk::Device& device,
-			vk::CommandPool& command_pool,
-			vk::Queue& queue,
+			UploadQueue& upload,
+			StagingRing& staging,
 			const vk::MemoryPropertyFlags propertyFlags,
 			const LoadedBitmap2D& bitmap)
 {
-	AllocatedMemory staging = create_staging_buffer(physical_device,
-													device,
-													get_pixels(bitmap),
-													bitmap.memory_size());
+	const TextureUploadSource source = texture_upload_source(bitmap);
+	const StagingAllocation pixels = staging.allocate(source.size, source.texel_size);
+	stage_upload_source(source, pixels.mapped);
+	Texture2D texture = create_empty_general_texture(physical_device,
+													 device,
+													 source.format,
+													 source.extent,
+													 vk::ImageTiling::eOptimal,
+													 propertyFlags);
+
+	const QueueFamilyHandover handover{get_image(texture), vk::ImageLayout::eTransferDstOptimal, 1};
+	with_upload_submit(device, upload, staging, std::span(&handover, 1),
+					   [&] (vk::CommandBuffer& commandbuffer)
+					   {
+						   texture.layout =
+							   transition_image_color_override(get_image(texture),
+															   commandbuffer);
+
+						   copy_buffer_to_image(pixels.buffer,
+												get_image(texture),
+												texture.extent.width,
+												texture.extent.height,
+												commandbuffer,
+												pixels.offset);
+					   });
+	return texture;
+}
+
+/**
+ * Block compressed images are sampled straight from the compressed blocks,
+ * but not every device can sample every block format.
+ */
+[[nodiscard]]
+bool
+supports_sampled_format(vk::PhysicalDevice& physical_device, const vk::Format format)
+{
+	const vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eSampledImage
+		| vk::FormatFeatureFlagBits::eTransferDst;
+	const auto features = physical_device.getFormatProperties(format).optimalTilingFeatures;
+	return (features & required) == required;
+}
+
+/**
+ * The blocks are copied as they are, the copy extent is the image size in
+ * pixels even when it is not a multiple of the 4x4 blocks.
+ */
+Texture2D
+copy_to_gpu(vk::PhysicalDevice& physical_device,
+			vk::Device& device,
+			UploadQueue& upload,
+			StagingRing& staging,
+			const vk::MemoryPropertyFlags propertyFlags,
+			const CompressedBitmap2D& bitmap)
+{
+	const StagingAllocation blocks =
+		staging.stage(get_pixels(bitmap),
+					  bitmap.memory_size(),
+					  BitmapPixelFormatBytesPerBlock(bitmap.format));
 	const auto extent = vk::Extent3D{}
 		.setWidth(bitmap.width)
 		.setHeight(bitmap.height)
 		.setDepth(1);
-	const auto format = BitmapPixelFormatToVulkanFormat(bitmap.format);
+	Texture2D texture = create_empty_texture(physical_device,
+											 device,
+											 BitmapPixelFormatToVulkanFormat(bitmap.format),
+											 extent,
+											 vk::ImageTiling::eOptimal,
+											 propertyFlags,
+											 vk::ImageUsageFlagBits::eTransferDst
+											 | vk::ImageUsageFlagBits::eSampled);
+
+	const QueueFamilyHandover handover{get_image(texture), vk::ImageLayout::eTransferDstOptimal, 1};
+	with_upload_submit(device, upload, staging, std::span(&handover, 1),
+					   [&] (vk::CommandBuffer& commandbuffer)
+					   {
+						   transition_image_layout(get_image(texture),
+												   vk::ImageLayout::eUndefined,
+												   vk::ImageLayout::eTransferDstOptimal,
+												   commandbuffer);
+						   texture.layout = vk::ImageLayout::eTransferDstOptimal;
+
+						   copy_buffer_to_image(blocks.buffer,
+												get_image(texture),
+												texture.extent.width,
+												texture.extent.height,
+												commandbuffer,
+												blocks.offset);
+					   });
+	return texture;
+}
+
+/**
+ * Compress the image on the cpu and upload the blocks, or upload it
+ * uncompressed when the device can not sample the block format.
+ */
+template <typename Image>
+Texture2D
+copy_to_gpu_compressed(vk::PhysicalDevice& physical_device,
+					   vk::Device& device,
+					   UploadQueue& upload,
+					   StagingRing& staging,
+					   const vk::MemoryPropertyFlags propertyFlags,
+					   const Image& image,
+					   const BitmapPixelFormat format)
+{
+	if (!supports_sampled_format(physical_device, BitmapPixelFormatToVulkanFormat(format)))
+		return copy_to_gpu(physical_device, device, upload, staging, propertyFlags, image);
+	return copy_to_gpu(physical_device, device, upload, staging, propertyFlags,
+					   compress_bitmap(image, format));
+}
+
+/**
+ * Upload every level of a packed chain of 4 byte pixels from a single
+ * staging allocation, with one copy region per level in a single submission.
+ * All levels are left in TransferDstOptimal.
+ */
+Texture2D
+upload_mip_levels(vk::PhysicalDevice& physical_device,
+				  vk::Device& device,
+				  UploadQueue& upload,
+				  StagingRing& staging,
+				  const vk::MemoryPropertyFlags propertyFlags,
+				  const vk::Format format,
+				  const std::span<const MipLevel> levels,
+				  const Pixel8bitRGBA* pixels,
+				  const size_t pixel_count)
+{
+	const StagingAllocation staged = staging.stage(pixels,
+												   pixel_count * sizeof(Pixel8bitRGBA),
+												   sizeof(Pixel8bitRGBA));
+	const auto extent = vk::Extent3D{}
+		.setWidth(levels.front().extent.width)
+		.setHeight(levels.front().extent.height)
+		.setDepth(1);
+
 	Texture2D texture = create_empty_general_texture(physical_device,
 													 device,
 													 format,
 													 extent,
 													 vk::ImageTiling::eOptimal,
-													 propertyFlags);
+													 propertyFlags,
+													 static_cast<uint32_t>(levels.size()));
 
-	with_buffer_submit(device, command_pool, queue,
+	std::vector<vk::BufferImageCopy> regions{};
+	regions.reserve(levels.size());
+	for (uint32_t i = 0; i < levels.size(); i++) {
+		const auto& level = levels[i];
+		const auto subresource = vk::ImageSubresourceLayers{}
+			.setAspectMask(vk::ImageAspectFlagBits::eColor)
+			.setMipLevel(i)
+			.setBaseArrayLayer(0)
+			.setLayerCount(1);
+		regions.push_back(vk::BufferImageCopy{}
+						  .setBufferOffset(staged.offset + level.offset * sizeof(Pixel8bitRGBA))
+						  .setBufferRowLength(0)
+						  .setBufferImageHeight(0)
+						  .setImageSubresource(subresource)
+						  .setImageOffset(vk::Offset3D{0, 0, 0})
+						  .setImageExtent(vk::Extent3D{level.extent.width, level.extent.height, 1}));
+	}
+
+	const QueueFamilyHandover handover{get_image(texture),
+										 vk::ImageLayout::eTransferDstOptimal,
+										 texture.mip_levels};
+	with_upload_submit(device, upload, staging, std::span(&handover, 1),
 					   [&] (vk::CommandBuffer& commandbuffer)
 					   {
-						   texture.layout =
-							   transition_image_color_override(get_image(texture),
-															   commandbuffer);
+						   transition_image_layout(get_image(texture),
+												   vk::ImageLayout::eUndefined,
+												   vk::ImageLayout::eTransferDstOptimal,
+												   commandbuffer,
+												   texture.mip_levels);
+						   texture.layout = vk::ImageLayout::eTransferDstOptimal;
+
+						   commandbuffer.copyBufferToImage(staged.buffer,
+														   get_image(texture),
+														   vk::ImageLayout::eTransferDstOptimal,
+														   regions);
+					   });
+	return texture;
+}
+
+Texture2D
+copy_to_gpu(vk::PhysicalDevice& physical_device,
+			vk::Device& device,
+			UploadQueue& upload,
+			StagingRing& staging,
+			const vk::MemoryPropertyFlags propertyFlags,
+			const MipChain& chain)
+{
+	return upload_mip_levels(physical_device, device, upload, staging, propertyFlags,
+							 chain.format, chain.levels, chain.pixels.data(), chain.pixels.size());
+}
+
+/**
+ * A cached bitmap is copied from the page cache straight into the staging
+ * buffer, with all the levels it was cached with.
+ */
+Texture2D
+copy_to_gpu(vk::PhysicalDevice& physical_device,
+			vk::Device& device,
+			UploadQueue& upload,
+			StagingRing& staging,
+			const vk::MemoryPropertyFlags propertyFlags,
+			const MappedBitmap2D& bitmap)
+{
+	return upload_mip_levels(physical_device, device, upload, staging, propertyFlags,
+							 bitmap.format, bitmap.levels, bitmap.pixels, bitmap.pixel_count);
+}
+
+/**
+ * Blitting a mip chain needs linear filtered blits from and to the format.
+ */
+[[nodiscard]]
+bool
+supports_linear_blit(vk::PhysicalDevice& physical_device, const vk::Format format)
+{
+	const vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eBlitSrc
+		| vk::FormatFeatureFlagBits::eBlitDst
+		| vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+	const auto features = physical_device.getFormatProperties(format).optimalTilingFeatures;
+	return (features & required) == required;
+}
+
+/**
+ * Record a cascade of blits filling the levels below a region of level 0
+ * from the one above it.
+ * All levels must be in TransferDstOptimal with the region of level 0
+ * written, each source level is moved to TransferSrcOptimal right before
+ * it is read and every level ends up in TransferDstOptimal again.
+ * Along an even size the region is widened to whole texel pairs, so the
+ * blit scales by exactly two and writes what blitting the whole level
+ * would. Along an odd size the whole level is blitted.
+ */
+void
+record_mipmap_blits(Texture2D& texture, vk::CommandBuffer& commandbuffer, const CanvasRect region)
+{
+	/*[begin, end) of the level below, and the source span it is blitted from*/
+	const auto halve = [] (int32_t& begin, int32_t& end, const int32_t size, const int32_t next_size)
+	{
+		if (size == next_size * 2) {
+			begin = begin / 2;
+			end = (end + 1) / 2;
+		}
+		else {
+			begin = 0;
+			end = next_size;
+		}
+	};
+	const auto source_span = [] (const int32_t begin,
+								 const int32_t end,
+								 const int32_t size,
+								 const int32_t next_size)
+	{
+		return size == next_size * 2 ? std::pair{begin * 2, end * 2} : std::pair{0, size};
+	};
+
+	int32_t width = static_cast<int32_t>(texture.extent.width);
+	int32_t height = static_cast<int32_t>(texture.extent.height);
+	int32_t x_begin = static_cast<int32_t>(region.offset.x);
+	int32_t y_begin = static_cast<int32_t>(region.offset.y);
+	int32_t x_end = static_cast<int32_t>(region.offset.x + region.extent.width);
+	int32_t y_end = static_cast<int32_t>(region.offset.y + region.extent.height);
+	for (uint32_t level = 1; level < texture.mip_levels; level++) {
+		transition_image_layout(get_image(texture),
+								vk::ImageLayout::eTransferDstOptimal,
+								vk::ImageLayout::eTransferSrcOptimal,
+								commandbuffer,
+								1,
+								level - 1);
+
+		const int32_t next_width = std::max(width / 2, 1);
+		const int32_t next_height = std::max(height / 2, 1);
+		halve(x_begin, x_end, width, next_width);
+		halve(y_begin, y_end, height, next_height);
+		const auto [src_x_begin, src_x_end] = source_span(x_begin, x_end, width, next_width);
+		const auto [src_y_begin, src_y_end] = source_span(y_begin, y_end, height, next_height);
 
-						   copy_buffer_to_image(staging.buffer.get(),
+		const auto subresource = [] (const uint32_t mip_level)
+		{
+			return vk::ImageSubresourceLayers{}
+				.setAspectMask(vk::ImageAspectFlagBits::eColor)
+				.setMipLevel(mip_level)
+				.setBaseArrayLayer(0)
+				.setLayerCount(1);
+		};
+		const auto blit = vk::ImageBlit{}
+			.setSrcSubresource(subresource(level - 1))
+			.setSrcOffsets({vk::Offset3D(src_x_begin, src_y_begin, 0),
+							vk::Offset3D(src_x_end, src_y_end, 1)})
+			.setDstSubresource(subresource(level))
+			.setDstOffsets({vk::Offset3D(x_begin, y_begin, 0),
+							vk::Offset3D(x_end, y_end, 1)});
+		commandbuffer.blitImage(get_image(texture),
+								vk::ImageLayout::eTransferSrcOptimal,
+								get_image(texture),
+								vk::ImageLayout::eTransferDstOptimal,
+								blit,
+								vk::Filter::eLinear);
+		width = next_width;
+		height = next_height;
+	}
+
+	if (texture.mip_levels > 1)
+		transition_image_layout(get_image(texture),
+								vk::ImageLayout::eTransferSrcOptimal,
+								vk::ImageLayout::eTransferDstOptimal,
+								commandbuffer,
+								texture.mip_levels - 1);
+}
+
+void
+record_mipmap_blits(Texture2D& texture, vk::CommandBuffer& commandbuffer)
+{
+	record_mipmap_blits(texture,
+						commandbuffer,
+						CanvasRect{CanvasOffset{0, 0},
+								   CanvasExtent{texture.extent.width, texture.extent.height}});
+}
+
+/**
+ * Upload level 0 and generate the rest of the mip chain on the gpu, in the
+ * same command buffer as the upload. Formats without linear filtered
+ * blits fall back to building the chain on the cpu with cpu_filter.
+ * All levels are left in TransferDstOptimal.
+ */
+template <typename Image>
+Texture2D
+copy_to_gpu_mipmapped(vk::PhysicalDevice& physical_device,
+					  vk::Device& device,
+					  UploadQueue& upload,
+					  StagingRing& staging,
+					  const vk::MemoryPropertyFlags propertyFlags,
+					  const Image& image,
+					  const vk::Format format,
+					  const MipFilter cpu_filter)
+{
+	if (!supports_linear_blit(physical_device, format))
+		return copy_to_gpu(physical_device, device, upload, staging, propertyFlags,
+						   build_mip_chain(image, cpu_filter));
+
+	const auto extent = get_extent(image);
+	const vk::DeviceSize texel_size = image.memory_size()
+		/ std::max(size_t{extent.width} * extent.height, size_t{1});
+	const StagingAllocation pixels = staging.stage(get_pixels(image),
+												   image.memory_size(),
+												   texel_size);
+	Texture2D texture = create_empty_general_texture(physical_device,
+													 device,
+													 format,
+													 vk::Extent3D{extent.width, extent.height, 1},
+													 vk::ImageTiling::eOptimal,
+													 propertyFlags,
+													 mip_level_count(extent));
+
+	const QueueFamilyHandover handover{get_image(texture),
+										 vk::ImageLayout::eTransferDstOptimal,
+										 texture.mip_levels};
+	with_upload_submit(device, upload, staging, std::span(&handover, 1),
+					   [&] (vk::CommandBuffer& commandbuffer)
+					   {
+						   transition_image_layout(get_image(texture),
+												   vk::ImageLayout::eUndefined,
+												   vk::ImageLayout::eTransferDstOptimal,
+												   commandbuffer,
+												   texture.mip_levels);
+						   texture.layout = vk::ImageLayout::eTransferDstOptimal;
+
+						   copy_buffer_to_image(pixels.buffer,
 												get_image(texture),
 												texture.extent.width,
 												texture.extent.height,
-												commandbuffer);
+												commandbuffer,
+												pixels.offset);
+					   },
+					   [&] (vk::CommandBuffer& commandbuffer)
+					   {
+						   record_mipmap_blits(texture, commandbuffer);
 					   });
 	return texture;
 }
 
+Texture2D
+copy_to_gpu_mipmapped(vk::PhysicalDevice& physical_device,
+					  vk::Device& device,
+					  UploadQueue& upload,
+					  StagingRing& staging,
+					  const vk::MemoryPropertyFlags propertyFlags,
+					  const Canvas8bitRGBA& canvas,
+					  const MipFilter cpu_filter = MipFilter::Box)
+{
+	return copy_to_gpu_mipmapped(physical_device, device, upload, staging, propertyFlags,
+								 canvas, PixelFormatRGBA8::vulkan_format, cpu_filter);
+}
+
+Texture2D
+copy_to_gpu_mipmapped(vk::PhysicalDevice& physical_device,
+					  vk::Device& device,
+					  UploadQueue& upload,
+					  StagingRing& staging,
+					  const vk::MemoryPropertyFlags propertyFlags,
+					  const LoadedBitmap2D& bitmap,
+					  const MipFilter cpu_filter = MipFilter::Box)
+{
+	if (bitmap.format == BitmapPixelFormat::RGB) {
+		/*the chain is blitted from the expanded RGBA pixels*/
+		Canvas8bitRGBA canvas{};
+		canvas.extent = get_extent(bitmap);
+		const size_t count = size_t{canvas.extent.width} * canvas.extent.height;
+		canvas.pixels = allocate_canvas_pixels(count, Pixel8bitRGBA{0, 0, 0, 255});
+		expand_rgb_to_rgba(get_pixels(bitmap), get_pixels(canvas), count);
+		return copy_to_gpu_mipmapped(physical_device, device, upload, staging, propertyFlags,
+									 canvas, cpu_filter);
+	}
+	return copy_to_gpu_mipmapped(physical_device, device, upload, staging, propertyFlags,
+								 bitmap, BitmapPixelFormatToVulkanFormat(bitmap.format), cpu_filter);
+}
+
+/**
+ * The vulkan format comes from the canvas pixel format at compile time,
+ * so every canvas format is uploaded as is, without any conversion.
+ */
+template <PixelFormat Format>
 Texture2D
 copy_to_gpu(vk::PhysicalDevice& physical_device,
 			vk::Device& device,
-			vk::CommandPool& command_pool,
-			vk::Queue& queue,
+			UploadQueue& upload,
+			StagingRing& staging,
 			const vk::MemoryPropertyFlags propertyFlags,
-			const Canvas8bitRGBA& canvas)
+			const Canvas<Format>& canvas)
 {
-	AllocatedMemory staging = create_staging_buffer(physical_device,
-													device,
-													get_pixels(canvas),
-													canvas.memory_size());
+	const StagingAllocation pixels = staging.stage(get_pixels(canvas),
+												   canvas.memory_size(),
+												   sizeof(typename Format::Pixel));
 	const auto extent = vk::Extent3D{}
 		.setWidth(canvas.extent.width)
 		.setHeight(canvas.extent.height)
@@ -180,36 +659,291 @@ copy_to_gpu(vk::PhysicalDevice& physical_device,
 
 	Texture2D texture = create_empty_general_texture(physical_device,
 													 device,
-													 vk::Format::eR8G8B8A8Srgb,
+													 Format::vulkan_format,
 													 extent,
 													 vk::ImageTiling::eOptimal,
 													 propertyFlags);
 
-	with_buffer_submit(device, command_pool, queue,
+	const QueueFamilyHandover handover{get_image(texture), vk::ImageLayout::eTransferDstOptimal, 1};
+	with_upload_submit(device, upload, staging, std::span(&handover, 1),
 					   [&] (vk::CommandBuffer& commandbuffer)
 					   {
 						   texture.layout =
 							   transition_image_color_override(get_image(texture),
 															   commandbuffer);
 
-						   copy_buffer_to_image(staging.buffer.get(),
+						   copy_buffer_to_image(pixels.buffer,
 												get_image(texture),
 												texture.extent.width,
 												texture.extent.height,
-												commandbuffer);
+												commandbuffer,
+												pixels.offset);
 					   });
 	return texture;
 }
 
+/**
+ * Upload many images at once: all of them are packed into one staging
+ * allocation, and all layout transitions and copies are recorded into one
+ * command buffer that is submitted once, instead of a submission and wait
+ * per texture. The textures are returned in the order of the sources, all
+ * in TransferDstOptimal.
+ */
+std::vector<Texture2D>
+copy_to_gpu_batched(vk::PhysicalDevice& physical_device,
+					vk::Device& device,
+					UploadQueue& upload,
+					StagingRing& staging,
+					const vk::MemoryPropertyFlags propertyFlags,
+					const std::span<const TextureUploadSource> sources)
+{
+	std::vector<Texture2D> textures{};
+	if (sources.empty())
+		return textures;
+
+	/*every image starts at an offset the copy accepts for its texel size*/
+	std::vector<vk::DeviceSize> offsets{};
+	offsets.reserve(sources.size());
+	vk::DeviceSize staging_size = 0;
+	vk::DeviceSize staging_alignment = 4;
+	for (const auto& source: sources) {
+		const vk::DeviceSize alignment = std::lcm(vk::DeviceSize{4}, source.texel_size);
+		staging_size = (staging_size + alignment - 1) / alignment * alignment;
+		staging_alignment = std::lcm(staging_alignment, alignment);
+		offsets.push_back(staging_size);
+		staging_size += source.size;
+	}
+
+	const StagingAllocation staged = staging.allocate(staging_size, staging_alignment);
+	for (size_t i = 0; i < sources.size(); i++)
+		stage_upload_source(sources[i], staged.mapped + offsets[i]);
+
+	textures.reserve(sources.size());
+	for (const auto& source: sources)
+		textures.push_back(create_empty_general_texture(physical_device,
+														device,
+														source.format,
+														source.extent,
+														vk::ImageTiling::eOptimal,
+														propertyFlags));
+
+	std::vector<vk::ImageMemoryBarrier> barriers{};
+	barriers.reserve(textures.size());
+	for (auto& texture: textures)
+		barriers.push_back(vk::ImageMemoryBarrier{}
+						   .setOldLayout(vk::ImageLayout::eUndefined)
+						   .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+						   .setSrcQueueFamilyIndex(vk::QueueFamilyIgnored)
+						   .setDstQueueFamilyIndex(vk::QueueFamilyIgnored)
+						   .setImage(get_image(texture))
+						   .setSubresourceRange(image_subresource_range(vk::ImageAspectFlagBits::eColor))
+						   .setSrcAccessMask(vk::AccessFlags())
+						   .setDstAccessMask(vk::AccessFlagBits::eTransferWrite));
+
+	std::vector<QueueFamilyHandover> handovers{};
+	handovers.reserve(textures.size());
+	for (auto& texture: textures)
+		handovers.push_back(QueueFamilyHandover{get_image(texture),
+												vk::ImageLayout::eTransferDstOptimal,
+												texture.mip_levels});
+
+	with_upload_submit(device, upload, staging, handovers,
+					   [&] (vk::CommandBuffer& commandbuffer)
+					   {
+						   commandbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+														 vk::PipelineStageFlagBits::eTransfer,
+														 vk::DependencyFlags(),
+														 nullptr,
+														 nullptr,
+														 barriers);
+
+						   for (size_t i = 0; i < textures.size(); i++) {
+							   textures[i].layout = vk::ImageLayout::eTransferDstOptimal;
+							   copy_buffer_to_image(staged.buffer,
+													get_image(textures[i]),
+													textures[i].extent.width,
+													textures[i].extent.height,
+													commandbuffer,
+													staged.offset + offsets[i]);
+						   }
+					   });
+	return textures;
+}
+
+/**
+ * Upload views of pixels into regions of a texture, the view at index i
+ * going to offsets[i]. Every view is packed tightly into one staging ring
+ * allocation row by row and copied with its own vk::BufferImageCopy, all in a single
+ * submission. The texture keeps its layout, and as it is already in use by
+ * the graphics queue the copies are submitted there.
+ * The mips of a mipmapped texture are blitted again below the bounding box
+ * of the regions, which needs a format with linear filtered blits.
+ */
+template <typename Pixel>
+void
+upload_texture_regions(vk::PhysicalDevice& physical_device,
+					   vk::Device& device,
+					   UploadQueue& upload,
+					   StagingRing& staging,
+					   Texture2D& texture,
+					   const std::span<const CanvasView<const Pixel>> views,
+					   const std::span<const CanvasOffset> offsets)
+{
+	/*every region starts at an offset the copy accepts for the texel size*/
+	constexpr vk::DeviceSize region_alignment = std::lcm(vk::DeviceSize{4}, sizeof(Pixel));
+	const auto region_size = [] (const CanvasView<const Pixel>& view)
+	{
+		const vk::DeviceSize size = vk::DeviceSize{view.extent.width} * view.extent.height
+			* sizeof(Pixel);
+		return (size + region_alignment - 1) / region_alignment * region_alignment;
+	};
+
+	vk::DeviceSize staging_size = 0;
+	for (const auto& view: views)
+		staging_size += region_size(view);
+	if (staging_size == 0)
+		return;
+
+	const bool mipmapped = texture.mip_levels > 1;
+	if (mipmapped && !supports_linear_blit(physical_device, texture.format))
+		throw std::runtime_error("Texture format cannot blit the mips of an updated region");
+
+	const StagingAllocation staged = staging.allocate(staging_size, region_alignment);
+
+	const auto subresource = vk::ImageSubresourceLayers{}
+		.setAspectMask(vk::ImageAspectFlagBits::eColor)
+		.setMipLevel(0)
+		.setBaseArrayLayer(0)
+		.setLayerCount(1);
+
+	std::vector<vk::BufferImageCopy> regions{};
+	regions.reserve(views.size());
+
+	uint8_t* mapped = staged.mapped;
+	vk::DeviceSize buffer_offset = 0;
+	std::optional<CanvasRect> updated{};
+	for (size_t i = 0; i < views.size(); i++) {
+		const auto& view = views[i];
+		if (view.empty())
+			continue;
+
+		const auto rect = CanvasRect{offsets[i], view.extent};
+		updated = updated ? bounding_rectangle(*updated, rect) : rect;
+
+		const size_t row_size = size_t{view.extent.width} * sizeof(Pixel);
+		for (uint32_t y = 0; y < view.extent.height; y++)
+			memcpy(mapped + buffer_offset + y * row_size, view.row(y).data(), row_size);
+
+		regions.push_back(vk::BufferImageCopy{}
+						  .setBufferOffset(staged.offset + buffer_offset)
+						  .setBufferRowLength(0)
+						  .setBufferImageHeight(0)
+						  .setImageSubresource(subresource)
+						  .setImageOffset(vk::Offset3D(offsets[i].x, offsets[i].y, 0))
+						  .setImageExtent(vk::Extent3D(view.extent.width,
+													   view.extent.height,
+													   1)));
+		buffer_offset += region_size(view);
+	}
+
+	const auto final_layout = texture.layout;
+	with_buffer_submit(device, upload.graphics_command_pool, upload.graphics_queue, staging,
+					   [&] (vk::CommandBuffer& commandbuffer)
+					   {
+						   if (final_layout != vk::ImageLayout::eTransferDstOptimal)
+							   transition_image_layout(get_image(texture),
+													   final_layout,
+													   vk::ImageLayout::eTransferDstOptimal,
+													   commandbuffer,
+													   texture.mip_levels);
+
+						   commandbuffer.copyBufferToImage(staged.buffer,
+														   get_image(texture),
+														   vk::ImageLayout::eTransferDstOptimal,
+														   regions);
+						   if (mipmapped)
+							   record_mipmap_blits(texture, commandbuffer, *updated);
+
+						   if (final_layout != vk::ImageLayout::eTransferDstOptimal)
+							   transition_image_layout(get_image(texture),
+													   vk::ImageLayout::eTransferDstOptimal,
+													   final_layout,
+													   commandbuffer,
+													   texture.mip_levels);
+					   });
+}
+
+/**
+ * Upload a view into the texture at offset, like a tile of a larger canvas.
+ */
+template <typename Pixel>
+void
+update_texture(vk::PhysicalDevice& physical_device,
+			   vk::Device& device,
+			   UploadQueue& upload,
+			   StagingRing& staging,
+			   Texture2D& texture,
+			   const CanvasView<Pixel> view,
+			   const CanvasOffset offset)
+{
+	if (uint64_t{offset.x} + view.extent.width > texture.extent.width
+		|| uint64_t{offset.y} + view.extent.height > texture.extent.height)
+		throw std::runtime_error("Canvas view does not fit the texture for update");
+
+	using Stored = std::remove_const_t<Pixel>;
+	const CanvasView<const Stored> source = view;
+	upload_texture_regions<Stored>(physical_device, device, upload, staging, texture,
+								   std::span(&source, 1), std::span(&offset, 1));
+}
+
+/**
+ * Upload only the damaged regions of a canvas into a texture that was
+ * created from it earlier, then clear the damage.
+ * Each region is a subview of the canvas, so the upload scales with the
+ * changed area instead of the image size.
+ */
+template <PixelFormat Format>
+void
+update_texture(vk::PhysicalDevice& physical_device,
+			   vk::Device& device,
+			   UploadQueue& upload,
+			   StagingRing& staging,
+			   Texture2D& texture,
+			   Canvas<Format>& canvas)
+{
+	using Pixel = typename Format::Pixel;
+
+	if (canvas.damage.empty())
+		return;
+	if (texture.extent.width != canvas.extent.width
+		|| texture.extent.height != canvas.extent.height)
+		throw std::runtime_error("Canvas and texture extents do not match for update");
+
+	const CanvasView<const Pixel> whole = as_view(std::as_const(canvas));
+	std::vector<CanvasView<const Pixel>> views{};
+	std::vector<CanvasOffset> offsets{};
+	views.reserve(canvas.damage.size());
+	offsets.reserve(canvas.damage.size());
+	for (const auto& rect: canvas.damage) {
+		views.push_back(subview(whole, rect));
+		offsets.push_back(rect.offset);
+	}
+
+	upload_texture_regions<Pixel>(physical_device, device, upload, staging, texture,
+								  views, offsets);
+	clear_damage(canvas);
+}
+
 vk::UniqueImageView
 create_texture_view(vk::Device& device,
 					Texture2D& texture,
-					const vk::ImageAspectFlags aspect)
+					const vk::ImageAspectFlags aspect,
+					const uint32_t level_count = VK_REMAINING_MIP_LEVELS)
 {
 	const auto subresourceRange = vk::ImageSubresourceRange{}
 		.setAspectMask(aspect)
 		.setBaseMipLevel(0)
-		.setLevelCount(1)
+		.setLevelCount(level_count)
 		.setBaseArrayLayer(0)
 		.setLayerCount(1);
 
@@ -0,0 +1,413 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "Texture.hpp"
+#include "StagingRing.hpp"
+
+using StreamedTextureHandle = uint32_t;
+
+/*gives the level 0 pixels of a streamed texture each time it is uploaded,
+  they only have to stay valid for the duration of the call*/
+using StreamedTextureSource = std::function<TextureUploadSource()>;
+
+struct TextureStreamerStats
+{
+	/*device local bytes held right now, by resident textures, textures
+	  being uploaded and replaced textures that frames in flight may read*/
+	vk::DeviceSize resident_bytes{0};
+	vk::DeviceSize budget{0};
+	uint32_t resident_textures{0};
+	uint32_t pending_uploads{0};
+	uint64_t uploads{0};
+	uint64_t evictions{0};
+	uint64_t dropped_mips{0};
+};
+
+constexpr vk::DeviceSize texture_streamer_default_budget = vk::DeviceSize{256} << 20;
+
+/**
+ * Keeps the device local memory of the textures added to it within a budget.
+ *
+ * Textures are uploaded the first time a render pass uses them, without
+ * waiting for the upload, and are drawn once it is done. end_frame()
+ * brings residency back within the budget, going through the textures
+ * unused by the frames in flight, least recently used first: each loses
+ * its top mip level, copied down on the gpu, until max_dropped_levels are
+ * gone, and is evicted after that. A reduced or evicted texture is
+ * uploaded again in full when it is used.
+ *
+ * Nothing here needs a surface, so it runs headless with a tiny budget.
+ */
+class TextureStreamer
+{
+public:
+	TextureStreamer(vk::PhysicalDevice& physical_device,
+					vk::Device& device,
+					UploadQueue& upload,
+					StagingRing& staging,
+					const vk::DeviceSize budget,
+					const vk::ImageLayout layout,
+					const uint32_t frames_in_flight,
+					const uint32_t max_dropped_levels = 2);
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	[[nodiscard]]
+	StreamedTextureHandle add(StreamedTextureSource&& source);
+
+	/*mark the texture as used by the current frame, and start uploading it
+	  when it is not resident in full. Returns the resident texture, which
+	  can be reduced by dropped levels, or nullptr while it is uploading*/
+	[[nodiscard]]
+	Texture2D* use(const StreamedTextureHandle handle);
+	/*level 0 extent of the full texture, once it has been uploaded*/
+	[[nodiscard]]
+	vk::Extent3D extent(const StreamedTextureHandle handle) const noexcept;
+
+	/*take in finished uploads and bring residency back within the budget*/
+	void end_frame();
+	void set_budget(const vk::DeviceSize budget) noexcept;
+
+	TextureStreamerStats stats() const;
+
+private:
+	struct Entry
+	{
+		StreamedTextureSource source;
+		vk::Extent3D extent{};
+		uint64_t last_used{0};
+
+		std::optional<Texture2D> texture;
+		vk::DeviceSize bytes{0};
+		uint32_t dropped_levels{0};
+
+		/*replaces texture once ticket is done*/
+		std::optional<Texture2D> incoming;
+		vk::DeviceSize incoming_bytes{0};
+		uint32_t incoming_dropped_levels{0};
+		SubmitTicket ticket;
+	};
+
+	struct Retired
+	{
+		Texture2D texture;
+		vk::DeviceSize bytes;
+		uint64_t frame;
+	};
+
+	void StartUpload(Entry& entry);
+	void DropTopLevel(Entry& entry);
+	void Evict(Entry& entry);
+	void Retire(Entry& entry);
+	vk::DeviceSize MemorySize(Texture2D& texture) const;
+	/*the bytes resident once every pending upload is done*/
+	vk::DeviceSize TargetBytes() const noexcept;
+
+	vk::PhysicalDevice physical_device_;
+	vk::Device device_;
+	UploadQueue& upload_;
+	StagingRing& staging_;
+	vk::DeviceSize budget_;
+	vk::ImageLayout layout_;
+	uint32_t frames_in_flight_;
+	uint32_t max_dropped_levels_;
+
+	uint64_t frame_{0};
+	std::vector<Entry> entries_;
+	std::deque<Retired> retired_;
+
+	uint64_t uploads_{0};
+	uint64_t evictions_{0};
+	uint64_t dropped_mips_{0};
+};
+
+TextureStreamer::TextureStreamer(vk::PhysicalDevice& physical_device,
+								 vk::Device& device,
+								 UploadQueue& upload,
+								 StagingRing& staging,
+								 const vk::DeviceSize budget,
+								 const vk::ImageLayout layout,
+								 const uint32_t frames_in_flight,
+								 const uint32_t max_dropped_levels)
+	: physical_device_(physical_device)
+	, device_(device)
+	, upload_(upload)
+	, staging_(staging)
+	, budget_(budget)
+	, layout_(layout)
+	, frames_in_flight_(std::max(frames_in_flight, 1u))
+	, max_dropped_levels_(max_dropped_levels)
+{
+}
+
+StreamedTextureHandle
+TextureStreamer::add(StreamedTextureSource&& source)
+{
+	Entry entry{};
+	entry.source = std::move(source);
+	entries_.push_back(std::move(entry));
+	return static_cast<StreamedTextureHandle>(entries_.size() - 1);
+}
+
+Texture2D*
+TextureStreamer::use(const StreamedTextureHandle handle)
+{
+	Entry& entry = entries_.at(handle);
+	entry.last_used = frame_;
+	if (!entry.ticket.valid() && (!entry.texture || entry.dropped_levels > 0))
+		StartUpload(entry);
+	return entry.texture ? &*entry.texture : nullptr;
+}
+
+vk::Extent3D
+TextureStreamer::extent(const StreamedTextureHandle handle) const noexcept
+{
+	return handle < entries_.size() ? entries_[handle].extent : vk::Extent3D{};
+}
+
+void
+TextureStreamer::end_frame()
+{
+	for (auto& entry: entries_) {
+		if (!entry.ticket.valid() || !entry.ticket.ready())
+			continue;
+		entry.ticket = SubmitTicket{};
+		Retire(entry);
+		entry.texture = std::move(entry.incoming);
+		entry.incoming.reset();
+		entry.bytes = entry.incoming_bytes;
+		entry.dropped_levels = entry.incoming_dropped_levels;
+		entry.incoming_bytes = 0;
+	}
+
+	while (!retired_.empty() && retired_.front().frame + frames_in_flight_ <= frame_)
+		retired_.pop_front();
+
+	/*only textures no frame in flight reads are given up*/
+	std::vector<Entry*> candidates{};
+	for (auto& entry: entries_)
+		if (entry.texture && !entry.ticket.valid() && entry.last_used + frames_in_flight_ <= frame_)
+			candidates.push_back(&entry);
+	std::sort(candidates.begin(), candidates.end(),
+			  [] (const Entry* lhs, const Entry* rhs) { return lhs->last_used < rhs->last_used; });
+
+	for (Entry* entry: candidates) {
+		if (TargetBytes() <= budget_)
+			break;
+		if (entry->texture->mip_levels > 1 && entry->dropped_levels < max_dropped_levels_)
+			DropTopLevel(*entry);
+		else
+			Evict(*entry);
+	}
+
+	frame_++;
+}
+
+void
+TextureStreamer::set_budget(const vk::DeviceSize budget) noexcept
+{
+	budget_ = budget;
+}
+
+TextureStreamerStats
+TextureStreamer::stats() const
+{
+	TextureStreamerStats stats{};
+	stats.budget = budget_;
+	for (const auto& entry: entries_) {
+		stats.resident_bytes += entry.bytes + entry.incoming_bytes;
+		stats.resident_textures += entry.texture ? 1 : 0;
+		stats.pending_uploads += entry.ticket.valid() ? 1 : 0;
+	}
+	for (const auto& retired: retired_)
+		stats.resident_bytes += retired.bytes;
+	stats.uploads = uploads_;
+	stats.evictions = evictions_;
+	stats.dropped_mips = dropped_mips_;
+	return stats;
+}
+
+void
+TextureStreamer::StartUpload(Entry& entry)
+{
+	const TextureUploadSource source = entry.source();
+	const uint32_t mip_levels = supports_linear_blit(physical_device_, source.format)
+		? mip_level_count(CanvasExtent{source.extent.width, source.extent.height})
+		: 1;
+
+	const StagingAllocation pixels = staging_.allocate(source.size, source.texel_size);
+	stage_upload_source(source, pixels.mapped);
+	Texture2D texture = create_empty_general_texture(physical_device_,
+													 device_,
+													 source.format,
+													 source.extent,
+													 vk::ImageTiling::eOptimal,
+													 vk::MemoryPropertyFlagBits::eDeviceLocal,
+													 mip_levels);
+
+	const QueueFamilyHandover handover{get_image(texture),
+										 vk::ImageLayout::eTransferDstOptimal,
+										 texture.mip_levels};
+	entry.ticket = with_upload_submit_async(device_, upload_, staging_, std::span(&handover, 1),
+											[&] (vk::CommandBuffer& commandbuffer)
+											{
+												transition_image_layout(get_image(texture),
+																		vk::ImageLayout::eUndefined,
+																		vk::ImageLayout::eTransferDstOptimal,
+																		commandbuffer,
+																		texture.mip_levels);
+												copy_buffer_to_image(pixels.buffer,
+																	 get_image(texture),
+																	 texture.extent.width,
+																	 texture.extent.height,
+																	 commandbuffer,
+																	 pixels.offset);
+											},
+											[&] (vk::CommandBuffer& commandbuffer)
+											{
+												record_mipmap_blits(texture, commandbuffer);
+												if (layout_ != vk::ImageLayout::eTransferDstOptimal)
+													transition_image_layout(get_image(texture),
+																			vk::ImageLayout::eTransferDstOptimal,
+																			layout_,
+																			commandbuffer,
+																			texture.mip_levels);
+												texture.layout = layout_;
+											});
+
+	entry.extent = source.extent;
+	entry.incoming_bytes = MemorySize(texture);
+	entry.incoming_dropped_levels = 0;
+	entry.incoming = std::move(texture);
+	uploads_++;
+}
+
+/**
+ * The smaller texture is filled by copying every level but the top one
+ * down a level, so the pixels do not have to be uploaded again.
+ */
+void
+TextureStreamer::DropTopLevel(Entry& entry)
+{
+	Texture2D& current = *entry.texture;
+	const auto extent = vk::Extent3D{}
+		.setWidth(std::max(current.extent.width >> 1, 1u))
+		.setHeight(std::max(current.extent.height >> 1, 1u))
+		.setDepth(1);
+	Texture2D smaller = create_empty_general_texture(physical_device_,
+													 device_,
+													 current.format,
+													 extent,
+													 vk::ImageTiling::eOptimal,
+													 vk::MemoryPropertyFlagBits::eDeviceLocal,
+													 current.mip_levels - 1);
+
+	std::vector<vk::ImageCopy> copies{};
+	copies.reserve(smaller.mip_levels);
+	for (uint32_t level = 0; level < smaller.mip_levels; level++) {
+		const auto subresource = [] (const uint32_t mip_level)
+		{
+			return vk::ImageSubresourceLayers{}
+				.setAspectMask(vk::ImageAspectFlagBits::eColor)
+				.setMipLevel(mip_level)
+				.setBaseArrayLayer(0)
+				.setLayerCount(1);
+		};
+		copies.push_back(vk::ImageCopy{}
+						 .setSrcSubresource(subresource(level + 1))
+						 .setSrcOffset(vk::Offset3D(0, 0, 0))
+						 .setDstSubresource(subresource(level))
+						 .setDstOffset(vk::Offset3D(0, 0, 0))
+						 .setExtent(vk::Extent3D(std::max(extent.width >> level, 1u),
+												 std::max(extent.height >> level, 1u),
+												 1)));
+	}
+
+	entry.ticket = with_buffer_submit_async(device_,
+											upload_.graphics_command_pool,
+											upload_.graphics_queue,
+											[&] (vk::CommandBuffer& commandbuffer)
+											{
+												if (current.layout != vk::ImageLayout::eTransferSrcOptimal)
+													transition_image_layout(get_image(current),
+																			current.layout,
+																			vk::ImageLayout::eTransferSrcOptimal,
+																			commandbuffer,
+																			current.mip_levels);
+												transition_image_layout(get_image(smaller),
+																		vk::ImageLayout::eUndefined,
+																		vk::ImageLayout::eTransferDstOptimal,
+																		commandbuffer,
+																		smaller.mip_levels);
+												commandbuffer.copyImage(get_image(current),
+																		vk::ImageLayout::eTransferSrcOptimal,
+																		get_image(smaller),
+																		vk::ImageLayout::eTransferDstOptimal,
+																		copies);
+												/*current is still drawn until the copy is done*/
+												if (current.layout != vk::ImageLayout::eTransferSrcOptimal)
+													transition_image_layout(get_image(current),
+																			vk::ImageLayout::eTransferSrcOptimal,
+																			current.layout,
+																			commandbuffer,
+																			current.mip_levels);
+												if (layout_ != vk::ImageLayout::eTransferDstOptimal)
+													transition_image_layout(get_image(smaller),
+																			vk::ImageLayout::eTransferDstOptimal,
+																			layout_,
+																			commandbuffer,
+																			smaller.mip_levels);
+												smaller.layout = layout_;
+											});
+
+	entry.incoming_bytes = MemorySize(smaller);
+	entry.incoming_dropped_levels = entry.dropped_levels + 1;
+	entry.incoming = std::move(smaller);
+	dropped_mips_++;
+}
+
+/**
+ * Only textures that no frame in flight reads are evicted, so they are
+ * freed right away.
+ */
+void
+TextureStreamer::Evict(Entry& entry)
+{
+	entry.texture.reset();
+	entry.bytes = 0;
+	entry.dropped_levels = 0;
+	evictions_++;
+}
+
+void
+TextureStreamer::Retire(Entry& entry)
+{
+	if (entry.texture)
+		retired_.push_back(Retired{std::move(*entry.texture), entry.bytes, entry.last_used});
+	entry.texture.reset();
+	entry.bytes = 0;
+}
+
+vk::DeviceSize
+TextureStreamer::MemorySize(Texture2D& texture) const
+{
+	return device_.getImageMemoryRequirements(get_image(texture)).size;
+}
+
+vk::DeviceSize
+TextureStreamer::TargetBytes() const noexcept
+{
+	vk::DeviceSize bytes = 0;
+	for (const auto& entry: entries_)
+		bytes += entry.ticket.valid() ? entry.incoming_bytes : entry.bytes;
+	return bytes;
+}
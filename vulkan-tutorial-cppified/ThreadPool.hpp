@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A fixed set of worker threads consuming a shared FIFO task queue.
+ * Tasks are submitted as callables and their results returned as futures.
+ */
+class ThreadPool
+{
+public:
+	explicit ThreadPool(const uint32_t worker_count);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t worker_count() const noexcept;
+
+	template <typename F>
+	std::future<std::invoke_result_t<F>> submit(F&& f);
+
+	/**
+	 * Run f(i) for every i in [0, count) and block until all are done.
+	 * The calling thread takes part in the work, so this is safe to call
+	 * from inside a task running on the pool itself.
+	 * When f throws, the indices not started yet are skipped and the first
+	 * exception is rethrown on the calling thread once every index is done.
+	 */
+	template <typename F>
+	void parallel_for(const uint32_t count, F&& f);
+
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread> workers_;
+	std::queue<std::function<void()>> tasks_;
+	std::mutex mutex_;
+	std::condition_variable wakeup_;
+	bool stopping_{false};
+};
+
+ThreadPool::ThreadPool(const uint32_t worker_count)
+{
+	workers_.reserve(worker_count);
+	for (uint32_t i = 0; i < worker_count; i++)
+		workers_.emplace_back([this] () { WorkerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wakeup_.notify_all();
+	for (auto& worker: workers_)
+		worker.join();
+}
+
+uint32_t
+ThreadPool::worker_count() const noexcept
+{
+	return static_cast<uint32_t>(workers_.size());
+}
+
+void
+ThreadPool::WorkerLoop()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wakeup_.wait(lock, [this] () { return stopping_ || !tasks_.empty(); });
+			if (stopping_ && tasks_.empty())
+				return;
+			task = std::move(tasks_.front());
+			tasks_.pop();
+		}
+		task();
+	}
+}
+
+template <typename F>
+std::future<std::invoke_result_t<F>>
+ThreadPool::submit(F&& f)
+{
+	using Result = std::invoke_result_t<F>;
+	/*std::function needs a copyable callable, so the task is shared*/
+	auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+	std::future<Result> result = task->get_future();
+
+	if (workers_.empty()) {
+		(*task)();
+		return result;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.emplace([task] () { (*task)(); });
+	}
+	wakeup_.notify_one();
+	return result;
+}
+
+template <typename F>
+void
+ThreadPool::parallel_for(const uint32_t count, F&& f)
+{
+	if (count == 0)
+		return;
+
+	if (workers_.empty() || count == 1) {
+		for (uint32_t i = 0; i < count; i++)
+			f(i);
+		return;
+	}
+
+	struct SharedProgress
+	{
+		std::atomic<uint32_t> next{0};
+		std::atomic<uint32_t> finished{0};
+		std::atomic<bool> failed{false};
+		/*the first exception thrown by f, guarded by the mutex*/
+		std::exception_ptr error;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	auto progress = std::make_shared<SharedProgress>();
+
+	/*helpers that start after every index is claimed never touch f,
+	  every claimed index counts as finished even when f threw, so the
+	  caller does not return and leave f dangling before the rest is done*/
+	auto run = [progress, count, &f] ()
+	{
+		uint32_t i;
+		while ((i = progress->next.fetch_add(1)) < count) {
+			if (!progress->failed.load()) {
+				try {
+					f(i);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(progress->mutex);
+					if (!progress->error)
+						progress->error = std::current_exception();
+					progress->failed.store(true);
+				}
+			}
+			if (progress->finished.fetch_add(1) + 1 == count) {
+				std::lock_guard<std::mutex> lock(progress->mutex);
+				progress->done.notify_all();
+			}
+		}
+	};
+
+	const uint32_t helpers = std::min(worker_count(), count - 1);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (uint32_t i = 0; i < helpers; i++)
+			tasks_.emplace(run);
+	}
+	wakeup_.notify_all();
+
+	run();
+
+	std::unique_lock<std::mutex> lock(progress->mutex);
+	progress->done.wait(lock, [&] () { return progress->finished.load() == count; });
+	if (progress->error)
+		std::rethrow_exception(progress->error);
+}
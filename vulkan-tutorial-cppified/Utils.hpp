@@ -1,3 +1,5 @@
+#pragma once
+
 //#define VULKAN_HPP_NO_STRUCT_CONSTRUCTORS
 #include <vulkan/vulkan.hpp>
 #include <SDL2/SDL.h>
@@ -8,6 +10,12 @@
 #include <variant>
 #include <array>
 #include <optional>
+#include <span>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
 
 [[nodiscard]]
 const std::string
@@ -83,6 +91,21 @@ get_sdl2_instance_extensions(SDL_Window* window)
 	return extensions;
 }
 
+[[nodiscard]]
+bool
+is_validation_layer_available(const char* layer)
+{
+	std::string str_layer = layer;
+	std::vector<vk::LayerProperties> properties = vk::enumerateInstanceLayerProperties();
+	for (vk::LayerProperties& property: properties) {
+		std::string str_available = property.layerName;
+		if (str_layer == str_available)
+			return true;
+	}
+
+	return false;
+}
+
 [[nodiscard]]
 std::vector<uint32_t>
 get_all_graphics_queue_family_indices(const vk::PhysicalDevice& device)
@@ -194,6 +217,30 @@ get_graphics_present_indices(vk::PhysicalDevice physical_device, vk::SurfaceKHR
 	return SplitGraphicsPresentIndices{graphics_indices[0], present_indices[0]};
 }
 
+/**
+ * A queue family that can transfer but not draw, so copies submitted to it
+ * run next to the rendering on the graphics queue instead of between it.
+ * Families that can not compute either are preferred, they are usually
+ * backed by the copy engines.
+ */
+[[nodiscard]]
+std::optional<uint32_t>
+get_dedicated_transfer_queue_family_index(const vk::PhysicalDevice& device)
+{
+	const auto properties = device.getQueueFamilyProperties();
+	std::optional<uint32_t> found{};
+	for (uint32_t i = 0; i < properties.size(); i++) {
+		const auto flags = properties[i].queueFlags;
+		if (!(flags & vk::QueueFlagBits::eTransfer) || (flags & vk::QueueFlagBits::eGraphics))
+			continue;
+		if (!(flags & vk::QueueFlagBits::eCompute))
+			return i;
+		if (!found)
+			found = i;
+	}
+	return found;
+}
+
 struct SharedIndexQueue {
 	vk::Queue shared;
 };
@@ -218,7 +265,7 @@ get_index_queues(const vk::Device& device, const GraphicsPresentIndices& indices
 	const auto graphics = std::get<SplitGraphicsPresentIndices>(indices).graphics;
 	const auto present = std::get<SplitGraphicsPresentIndices>(indices).present;
 	return SplitIndexQueues{device.getQueue(graphics, 0),
-		                    device.getQueue(present, 1)};
+		                    device.getQueue(present, 0)};
 }
 
 [[nodiscard]]
@@ -241,6 +288,30 @@ graphics_queue(IndexQueues& queues)
 	return std::get<SplitIndexQueues>(queues).graphics;
 }
 
+/**
+ * Where uploads are recorded and submitted. With a dedicated transfer
+ * queue the copies run there, and the images are handed over to the
+ * graphics family they are used on afterwards. Without one both sides
+ * are the graphics queue.
+ */
+struct UploadQueue
+{
+	vk::CommandPool command_pool;
+	vk::Queue queue;
+	uint32_t family;
+	vk::CommandPool graphics_command_pool;
+	vk::Queue graphics_queue;
+	uint32_t graphics_family;
+
+	bool dedicated() const noexcept;
+};
+
+bool
+UploadQueue::dedicated() const noexcept
+{
+	return family != graphics_family;
+}
+
 [[nodiscard]]
 vk::SurfaceFormatKHR
 get_swapchain_surface_format(const std::vector<vk::SurfaceFormatKHR>& availables) {
@@ -430,13 +501,14 @@ allocate_image(vk::PhysicalDevice physical_device,
 			   const vk::Format format,
 			   const vk::ImageTiling tiling,
 			   const vk::MemoryPropertyFlags propertyFlags,
-			   const vk::ImageUsageFlags usage) noexcept
+			   const vk::ImageUsageFlags usage,
+			   const uint32_t mip_levels = 1) noexcept
 {
 	const auto imageCreateInfo = vk::ImageCreateInfo{}
 		.setImageType(vk::ImageType::e2D)
 		.setFormat(format)
 		.setExtent(extent)
-		.setMipLevels(1)
+		.setMipLevels(mip_levels)
 		.setArrayLayers(1)
 		.setTiling(tiling)
 		.setUsage(usage) 
@@ -482,27 +554,238 @@ beginSingleTimeCommands(vk::Device& device,
     return commandBuffer;
 }
 
+/**
+ * A submission that may still be running on the gpu. It owns the fence
+ * that tells when it is done, and keeps the command buffer and whatever
+ * else the submission reads alive until then, so the ticket waits for the
+ * submission when it is destroyed early.
+ * When created with a semaphore, it is signaled on completion so a single
+ * later submission can be chained on it without waiting on the cpu.
+ */
+class SubmitTicket
+{
+public:
+	SubmitTicket() = default;
+	SubmitTicket(vk::Device device,
+				 std::shared_ptr<const vk::UniqueFence> fence,
+				 vk::UniqueCommandBuffer commands,
+				 vk::UniqueSemaphore semaphore);
+	~SubmitTicket();
+	SubmitTicket(SubmitTicket&&) noexcept = default;
+	SubmitTicket& operator=(SubmitTicket&& rhs) noexcept;
+	SubmitTicket(const SubmitTicket&) = delete;
+	SubmitTicket& operator=(const SubmitTicket&) = delete;
+
+	bool valid() const noexcept;
+	/*whether the submission is done, without blocking*/
+	bool ready() const;
+	void wait() const;
+
+	vk::Fence fence() const noexcept;
+	vk::Semaphore semaphore() const noexcept;
+
+	/*own a resource until the submission is done*/
+	template <typename Resource>
+	void keep_alive(Resource&& resource);
+
+private:
+	/*wait without throwing, for the paths that must not*/
+	void WaitIgnoringErrors() const noexcept;
+
+	vk::Device device_;
+	std::shared_ptr<const vk::UniqueFence> fence_;
+	vk::UniqueCommandBuffer commands_;
+	vk::UniqueSemaphore semaphore_;
+	std::vector<std::shared_ptr<void>> resources_;
+};
+
+SubmitTicket::SubmitTicket(vk::Device device,
+						   std::shared_ptr<const vk::UniqueFence> fence,
+						   vk::UniqueCommandBuffer commands,
+						   vk::UniqueSemaphore semaphore)
+	: device_(device)
+	, fence_(std::move(fence))
+	, commands_(std::move(commands))
+	, semaphore_(std::move(semaphore))
+{
+}
+
+SubmitTicket::~SubmitTicket()
+{
+	WaitIgnoringErrors();
+}
+
+SubmitTicket&
+SubmitTicket::operator=(SubmitTicket&& rhs) noexcept
+{
+	if (this != &rhs) {
+		WaitIgnoringErrors();
+		resources_.clear();
+		device_ = rhs.device_;
+		fence_ = std::move(rhs.fence_);
+		commands_ = std::move(rhs.commands_);
+		semaphore_ = std::move(rhs.semaphore_);
+		resources_ = std::move(rhs.resources_);
+	}
+	return *this;
+}
+
+bool
+SubmitTicket::valid() const noexcept
+{
+	return fence_ != nullptr;
+}
+
+bool
+SubmitTicket::ready() const
+{
+	return !valid() || device_.getFenceStatus(fence_->get()) == vk::Result::eSuccess;
+}
+
+void
+SubmitTicket::wait() const
+{
+	if (!valid())
+		return;
+	const auto waitresult = device_.waitForFences(fence_->get(),
+												  true,
+												  std::numeric_limits<uint64_t>::max());
+	if (waitresult != vk::Result::eSuccess)
+		throw std::runtime_error("Could not wait for submission fence");
+}
 
 void
-endSingleTimeCommands(vk::Queue& queue,
-					  vk::CommandBuffer& command_buffer) 
+SubmitTicket::WaitIgnoringErrors() const noexcept
 {
-	command_buffer.end();
+	if (!valid())
+		return;
+	/*after a lost device there is nothing left to wait for, so the
+	  resources can be released either way*/
+	try {
+		(void)device_.waitForFences(fence_->get(),
+									true,
+									std::numeric_limits<uint64_t>::max());
+	}
+	catch (const std::exception&) {
+	}
+}
+
+vk::Fence
+SubmitTicket::fence() const noexcept
+{
+	return valid() ? fence_->get() : vk::Fence{};
+}
+
+vk::Semaphore
+SubmitTicket::semaphore() const noexcept
+{
+	return semaphore_ ? semaphore_.get() : vk::Semaphore{};
+}
+
+template <typename Resource>
+void
+SubmitTicket::keep_alive(Resource&& resource)
+{
+	using Stored = std::remove_cvref_t<Resource>;
+	resources_.push_back(std::make_shared<Stored>(std::forward<Resource>(resource)));
+}
+
+/**
+ * End and submit commands recorded into a single time command buffer,
+ * signaling fence and, if given, semaphore, after waiting on the semaphore
+ * of after, which is kept alive by the returned ticket.
+ */
+[[nodiscard]]
+SubmitTicket
+submit_single_time_commands(vk::Device& device,
+							vk::Queue& queue,
+							vk::UniqueCommandBuffer commands,
+							std::shared_ptr<const vk::UniqueFence> fence,
+							SubmitTicket* after,
+							const bool signal_semaphore)
+{
+	commands->end();
+
+	vk::UniqueSemaphore semaphore{};
+	if (signal_semaphore)
+		semaphore = device.createSemaphoreUnique(vk::SemaphoreCreateInfo{});
+
+	const auto command_buffer = commands.get();
 	auto submitinfo = vk::SubmitInfo{}
 		.setCommandBuffers(command_buffer);
-	queue.submit(submitinfo);
-	queue.waitIdle();
+
+	const vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eAllCommands;
+	const vk::Semaphore wait_semaphore = after != nullptr ? after->semaphore() : vk::Semaphore{};
+	if (after != nullptr) {
+		if (!wait_semaphore)
+			throw std::invalid_argument("chained submission without a semaphore to wait on");
+		submitinfo
+			.setWaitSemaphores(wait_semaphore)
+			.setWaitDstStageMask(wait_stage);
+	}
+	const vk::Semaphore signal = semaphore ? semaphore.get() : vk::Semaphore{};
+	if (signal)
+		submitinfo.setSignalSemaphores(signal);
+
+	queue.submit(submitinfo, fence->get());
+
+	SubmitTicket ticket(device, std::move(fence), std::move(commands), std::move(semaphore));
+	if (after != nullptr)
+		ticket.keep_alive(std::move(*after));
+	return ticket;
+}
+
+/**
+ * Record f into a single time command buffer and submit it without
+ * waiting for it. The ticket can be polled, waited on, or chained on by
+ * passing it to a later submission when signal_semaphore is set.
+ */
+[[nodiscard]]
+SubmitTicket
+with_buffer_submit_async(vk::Device& device,
+						 vk::CommandPool& command_pool,
+						 vk::Queue& queue,
+						 std::function<void(vk::CommandBuffer&)>&& f,
+						 const bool signal_semaphore = false)
+{
+	auto buffer = beginSingleTimeCommands(device, command_pool);
+	f(buffer.get());
+	auto fence = std::make_shared<const vk::UniqueFence>(device.createFenceUnique(vk::FenceCreateInfo{}));
+	return submit_single_time_commands(device, queue, std::move(buffer), std::move(fence),
+									   nullptr, signal_semaphore);
 }
 
+/**
+ * Like above, but the gpu waits for the submission of after before
+ * running this one, and the returned ticket takes over after.
+ */
+[[nodiscard]]
+SubmitTicket
+with_buffer_submit_async(vk::Device& device,
+						 vk::CommandPool& command_pool,
+						 vk::Queue& queue,
+						 SubmitTicket&& after,
+						 std::function<void(vk::CommandBuffer&)>&& f,
+						 const bool signal_semaphore = false)
+{
+	auto buffer = beginSingleTimeCommands(device, command_pool);
+	f(buffer.get());
+	auto fence = std::make_shared<const vk::UniqueFence>(device.createFenceUnique(vk::FenceCreateInfo{}));
+	return submit_single_time_commands(device, queue, std::move(buffer), std::move(fence),
+									   &after, signal_semaphore);
+}
+
+/**
+ * Waits on the fence of this submission, instead of for the whole queue
+ * to become idle.
+ */
 void
 with_buffer_submit(vk::Device& device,
 				   vk::CommandPool& command_pool,
 				   vk::Queue& queue,
 				   std::function<void(vk::CommandBuffer&)>&& f)
 {
-	auto buffer = beginSingleTimeCommands(device, command_pool);
-	f(buffer.get());
-	endSingleTimeCommands(queue, buffer.get());
+	with_buffer_submit_async(device, command_pool, queue, std::move(f)).wait();
 }
 
 void
@@ -522,18 +805,66 @@ copy_buffer(vk::Device& device,
 						});
 }
 
+struct LayoutAccess
+{
+	vk::AccessFlags access;
+	vk::PipelineStageFlags stage;
+};
+
+/**
+ * The accesses that have to be made available before leaving, or that
+ * have to wait on entering, an image layout.
+ */
+[[nodiscard]]
+LayoutAccess
+image_layout_access(const vk::ImageLayout layout)
+{
+	switch (layout) {
+	case vk::ImageLayout::eUndefined:
+		return LayoutAccess{vk::AccessFlags(), vk::PipelineStageFlagBits::eTopOfPipe};
+	case vk::ImageLayout::eTransferDstOptimal:
+		return LayoutAccess{vk::AccessFlagBits::eTransferWrite,
+			                vk::PipelineStageFlagBits::eTransfer};
+	case vk::ImageLayout::eTransferSrcOptimal:
+		return LayoutAccess{vk::AccessFlagBits::eTransferRead,
+			                vk::PipelineStageFlagBits::eTransfer};
+	case vk::ImageLayout::eShaderReadOnlyOptimal:
+		return LayoutAccess{vk::AccessFlagBits::eShaderRead,
+			                vk::PipelineStageFlagBits::eFragmentShader};
+	case vk::ImageLayout::eColorAttachmentOptimal:
+		return LayoutAccess{vk::AccessFlagBits::eColorAttachmentRead
+			                | vk::AccessFlagBits::eColorAttachmentWrite,
+			                vk::PipelineStageFlagBits::eColorAttachmentOutput};
+	case vk::ImageLayout::eGeneral:
+		return LayoutAccess{vk::AccessFlagBits::eMemoryRead
+			                | vk::AccessFlagBits::eMemoryWrite,
+			                vk::PipelineStageFlagBits::eAllCommands};
+	default:
+		break;
+	}
+	throw std::invalid_argument("unsupported layout transition!");
+}
+
 void
 transition_image_layout(vk::Image& image,
 						const vk::ImageLayout old_layout,
 						const vk::ImageLayout new_layout,
-						vk::CommandBuffer& commandbuffer)
+						vk::CommandBuffer& commandbuffer,
+						const uint32_t level_count = 1,
+						const uint32_t base_level = 0)
 {
+	if (new_layout == vk::ImageLayout::eUndefined)
+		throw std::invalid_argument("unsupported layout transition!");
+
 	auto range = vk::ImageSubresourceRange{}
 		.setAspectMask(vk::ImageAspectFlagBits::eColor)
-		.setBaseMipLevel(0)
-		.setLevelCount(1)
+		.setBaseMipLevel(base_level)
+		.setLevelCount(level_count)
 		.setBaseArrayLayer(0)
 		.setLayerCount(1);
+
+	const auto source = image_layout_access(old_layout);
+	const auto destination = image_layout_access(new_layout);
 	
 	auto barrier = vk::ImageMemoryBarrier{}
 		.setOldLayout(old_layout)
@@ -541,40 +872,101 @@ transition_image_layout(vk::Image& image,
 		.setSrcQueueFamilyIndex(vk::QueueFamilyIgnored)
 		.setDstQueueFamilyIndex(vk::QueueFamilyIgnored)
 		.setImage(image)
-		.setSubresourceRange(range);
-
-	vk::PipelineStageFlags sourceStage;
-	vk::PipelineStageFlags destinationStage;
-
-	if (old_layout == vk::ImageLayout::eUndefined 
-		&& new_layout == vk::ImageLayout::eTransferDstOptimal) {
-		barrier
-			.setSrcAccessMask(vk::AccessFlags())
-			.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
-		sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
-		destinationStage = vk::PipelineStageFlagBits::eTransfer;
-	}
-	else if (old_layout == vk::ImageLayout::eTransferDstOptimal
-			 && new_layout == vk::ImageLayout::eShaderReadOnlyOptimal) {
-
-		barrier
-			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
-			.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-		sourceStage = vk::PipelineStageFlagBits::eTransfer;
-		destinationStage = vk::PipelineStageFlagBits::eFragmentShader;
-	}
-	else {
-		throw std::invalid_argument("unsupported layout transition!");
-	}
+		.setSubresourceRange(range)
+		.setSrcAccessMask(source.access)
+		.setDstAccessMask(destination.access);
 
-	commandbuffer.pipelineBarrier(sourceStage,
-								  destinationStage,
+	commandbuffer.pipelineBarrier(source.stage,
+								  destination.stage,
 								  vk::DependencyFlags(), 
 								  nullptr,
 								  nullptr,
 								  barrier);
 };
 
+struct QueueFamilyHandover
+{
+	vk::Image image;
+	vk::ImageLayout layout;
+	uint32_t level_count;
+};
+
+/**
+ * Record the release half of moving images from src_family to dst_family,
+ * after the transfer writes that filled them. The images keep their layout.
+ */
+void
+release_queue_family_ownership(const std::span<const QueueFamilyHandover> handovers,
+							   const uint32_t src_family,
+							   const uint32_t dst_family,
+							   vk::CommandBuffer& commandbuffer)
+{
+	std::vector<vk::ImageMemoryBarrier> barriers{};
+	barriers.reserve(handovers.size());
+	for (const auto& handover: handovers)
+		barriers.push_back(vk::ImageMemoryBarrier{}
+						   .setOldLayout(handover.layout)
+						   .setNewLayout(handover.layout)
+						   .setSrcQueueFamilyIndex(src_family)
+						   .setDstQueueFamilyIndex(dst_family)
+						   .setImage(handover.image)
+						   .setSubresourceRange(vk::ImageSubresourceRange{}
+												.setAspectMask(vk::ImageAspectFlagBits::eColor)
+												.setBaseMipLevel(0)
+												.setLevelCount(handover.level_count)
+												.setBaseArrayLayer(0)
+												.setLayerCount(1))
+						   .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+						   .setDstAccessMask(vk::AccessFlags()));
+
+	commandbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+								  vk::PipelineStageFlagBits::eBottomOfPipe,
+								  vk::DependencyFlags(),
+								  nullptr,
+								  nullptr,
+								  barriers);
+}
+
+/**
+ * Record the acquire half of a handover, matching the release on the
+ * other queue, which has to be waited for with a semaphore on the transfer stage.
+ */
+void
+acquire_queue_family_ownership(const std::span<const QueueFamilyHandover> handovers,
+							   const uint32_t src_family,
+							   const uint32_t dst_family,
+							   vk::CommandBuffer& commandbuffer)
+{
+	std::vector<vk::ImageMemoryBarrier> barriers{};
+	barriers.reserve(handovers.size());
+	vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eTransfer;
+	for (const auto& handover: handovers) {
+		const auto destination = image_layout_access(handover.layout);
+		stages |= destination.stage;
+		barriers.push_back(vk::ImageMemoryBarrier{}
+						   .setOldLayout(handover.layout)
+						   .setNewLayout(handover.layout)
+						   .setSrcQueueFamilyIndex(src_family)
+						   .setDstQueueFamilyIndex(dst_family)
+						   .setImage(handover.image)
+						   .setSubresourceRange(vk::ImageSubresourceRange{}
+												.setAspectMask(vk::ImageAspectFlagBits::eColor)
+												.setBaseMipLevel(0)
+												.setLevelCount(handover.level_count)
+												.setBaseArrayLayer(0)
+												.setLayerCount(1))
+						   .setSrcAccessMask(vk::AccessFlags())
+						   .setDstAccessMask(destination.access));
+	}
+
+	commandbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+								  stages,
+								  vk::DependencyFlags(),
+								  nullptr,
+								  nullptr,
+								  barriers);
+}
+
 vk::ImageSubresourceRange 
 image_subresource_range(const vk::ImageAspectFlags aspect_mask)
 {
@@ -619,11 +1011,12 @@ transition_image_color_override(vk::Image& image,
 }
 
 void
-copy_buffer_to_image(vk::Buffer& buffer,
+copy_buffer_to_image(const vk::Buffer& buffer,
 					 vk::Image& image,
 					 const uint32_t width,
 					 const uint32_t height,
-					 vk::CommandBuffer& commandbuffer)
+					 vk::CommandBuffer& commandbuffer,
+					 const vk::DeviceSize buffer_offset = 0)
 {
 	auto subresource = vk::ImageSubresourceLayers{}
 		.setAspectMask(vk::ImageAspectFlagBits::eColor)
@@ -642,7 +1035,7 @@ copy_buffer_to_image(vk::Buffer& buffer,
 		.setDepth(1);
 	
 	auto region = vk::BufferImageCopy{}
-		.setBufferOffset(0)
+		.setBufferOffset(buffer_offset)
 		.setBufferRowLength(0)
 		.setBufferImageHeight(0)
 		.setImageSubresource(subresource)
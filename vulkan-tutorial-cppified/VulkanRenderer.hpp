@@ -48,6 +48,8 @@ public:
 
 	vk::CommandPool& command_pool();
 	vk::Queue& graphics_queue();
+	StagingRing& staging_ring();
+	UploadQueue& upload_queue();
 	
 	const bool per_frame_debug_print{false};
 
@@ -63,12 +65,19 @@ public:
 	//TODO: get some automatic destructon onto this surface
 	VkSurfaceKHR raw_window_surface_;
 	GraphicsPresentIndices graphics_present_indices_;
+	/*a transfer only family, when the device has one*/
+	std::optional<uint32_t> transfer_index_;
 	vk::UniqueDevice device;
 	IndexQueues index_queues_;
+	vk::Queue transfer_queue_;
 
 	vk::SurfaceFormatKHR swapchain_format_;
 	vk::UniqueSwapchainKHR swapchain_;
 	vk::UniqueCommandPool commandpool_;
+	vk::UniqueCommandPool transfer_commandpool_;
+	UploadQueue upload_queue_;
+	/*persistently mapped memory every upload is staged in*/
+	std::optional<StagingRing> staging_ring_;
 
 	/*Per swapchain image*/
 	std::vector<vk::Image> swapchain_images_;
@@ -95,6 +104,7 @@ private:
 	void CreateSwapChain();
 	void CreateCommandpool();
 	void CreateCommandbuffers();
+	void CreateStagingRing();
 	void CreateRenderTargets();
 	void CreateSyncObjects();
 
@@ -114,6 +124,16 @@ vk::Queue& PresentationContext::graphics_queue()
 	return ::graphics_queue(index_queues_);
 }
 
+StagingRing& PresentationContext::staging_ring()
+{
+	return *staging_ring_;
+}
+
+UploadQueue& PresentationContext::upload_queue()
+{
+	return upload_queue_;
+}
+
 PresentationContext::~PresentationContext()
 {
 	// TODO: Port over the ResourceWrapperRuntime so we can automatically destroy all this stuff..
@@ -140,6 +160,7 @@ PresentationContext::PresentationContext(const uint32_t frames_in_flight)
 	CreateSwapChain();
 	CreateCommandpool();
 	CreateCommandbuffers();
+	CreateStagingRing();
 	CreateSyncObjects();
 
 	CreateRenderTargets();
@@ -161,21 +182,6 @@ void PresentationContext::CreateWindow()
 							   0 | SDL_WINDOW_VULKAN);
 }
 
-[[nodiscard]]
-bool
-is_validation_layer_available(const char* layer)
-{
-	std::string str_layer = layer;
-	std::vector<vk::LayerProperties> properties = vk::enumerateInstanceLayerProperties();
-	for (vk::LayerProperties& property: properties) {
-		std::string str_available = property.layerName;
-		if (str_layer == str_available)
-			return true;
-	}
-
-	return false;
-}
-
 void PresentationContext::CreateInstance()
 {
 	std::vector<const char*> sdl_instance_extensions = get_sdl2_instance_extensions(window_);
@@ -261,26 +267,42 @@ void PresentationContext::GetQueueFamilyIndices()
 	else {
 		std::cout << "> found SPLIT graphics present indices" << std::endl;
 	}
+
+	transfer_index_ = get_dedicated_transfer_queue_family_index(physical_device);
+	if (transfer_index_)
+		std::cout << "> found DEDICATED transfer index " << *transfer_index_ << std::endl;
+	else
+		std::cout << "> found no dedicated transfer index, uploading on graphics" << std::endl;
 }
 
 void PresentationContext::CreateDevice()
 {
 	float queuePriority = 1.0f;
-	uint32_t device_index = present_index(graphics_present_indices_);
 
-	auto deviceQueueCreateInfo = vk::DeviceQueueCreateInfo{}
-		.setFlags({})
-		.setQueueFamilyIndex(device_index)
-		.setPQueuePriorities(&queuePriority)
-		.setQueueCount(1);
+	/*one queue of every family that is used, each family only once*/
+	std::vector<uint32_t> families{
+		graphics_index(graphics_present_indices_),
+		present_index(graphics_present_indices_),
+	};
+	if (transfer_index_)
+		families.push_back(*transfer_index_);
+	std::ranges::sort(families);
+	families.erase(std::unique(families.begin(), families.end()), families.end());
+
+	std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos{};
+	for (const auto family: families)
+		deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo{}
+										 .setFlags({})
+										 .setQueueFamilyIndex(family)
+										 .setPQueuePriorities(&queuePriority)
+										 .setQueueCount(1));
 
 	const std::vector<const char*> device_extensions = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 	};
 	
 	auto deviceCreateInfo = vk::DeviceCreateInfo{}
-		.setQueueCreateInfoCount(1)
-		.setQueueCreateInfos(deviceQueueCreateInfo)
+		.setQueueCreateInfos(deviceQueueCreateInfos)
 		.setPpEnabledExtensionNames(device_extensions.data())
 		.setEnabledExtensionCount(device_extensions.size());
 	
@@ -299,6 +321,11 @@ void PresentationContext::CreateIndexQueues()
 	else {
 		std::cout << "> created SPLIT index queues" << std::endl;
 	}
+
+	if (transfer_index_) {
+		transfer_queue_ = device->getQueue(*transfer_index_, 0);
+		std::cout << "> created DEDICATED transfer queue" << std::endl;
+	}
 }
 
 
@@ -502,6 +529,25 @@ void PresentationContext::CreateCommandpool()
 		.setQueueFamilyIndex(graphics_index(graphics_present_indices_));
 	commandpool_ = device->createCommandPoolUnique(commandPoolCreateInfo, nullptr);
 
+	const uint32_t graphics_family = graphics_index(graphics_present_indices_);
+	upload_queue_.graphics_command_pool = commandpool_.get();
+	upload_queue_.graphics_queue = graphics_queue();
+	upload_queue_.graphics_family = graphics_family;
+	if (transfer_index_) {
+		auto transferPoolCreateInfo = vk::CommandPoolCreateInfo{}
+			.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+			.setQueueFamilyIndex(*transfer_index_);
+		transfer_commandpool_ = device->createCommandPoolUnique(transferPoolCreateInfo, nullptr);
+		upload_queue_.command_pool = transfer_commandpool_.get();
+		upload_queue_.queue = transfer_queue_;
+		upload_queue_.family = *transfer_index_;
+	}
+	else {
+		upload_queue_.command_pool = commandpool_.get();
+		upload_queue_.queue = graphics_queue();
+		upload_queue_.family = graphics_family;
+	}
+
 	std::cout << "> Created Command pool" << std::endl;
 }
 
@@ -518,6 +564,13 @@ void PresentationContext::CreateCommandbuffers()
 	std::cout << "> Created " << commandbuffers_.size() << " Command buffers" << std::endl;
 }
 
+void PresentationContext::CreateStagingRing()
+{
+	staging_ring_.emplace(physical_device, device.get(), staging_ring_default_capacity);
+	std::cout << "> Created " << (staging_ring_default_capacity >> 20)
+			  << " MiB Staging ring" << std::endl;
+}
+
 void PresentationContext::CreateSyncObjects()
 {
 	const auto semaphoreCreateInfo = vk::SemaphoreCreateInfo{};
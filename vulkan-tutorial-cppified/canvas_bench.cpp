@@ -0,0 +1,553 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "BlockCompression.hpp"
+#include "Canvas.hpp"
+#include "CanvasBlend.hpp"
+#include "CanvasDisplayList.hpp"
+#include "CanvasRaster.hpp"
+
+/**
+ * Micro benchmarks of the canvas kernels against the paths they replaced.
+ * Every case is run a few times and the fastest run is reported, so the
+ * numbers are about the kernel and not about page faults or the scheduler.
+ */
+
+constexpr int bench_runs = 7;
+
+constexpr CanvasExtent bench_1080p{1920, 1080};
+constexpr CanvasExtent bench_4k{3840, 2160};
+
+/*a fast path that disagrees with its reference fails the run*/
+int mismatches = 0;
+
+void
+report_mismatch(const std::string& name, const char* what)
+{
+	std::printf("%s: %s\n", name.c_str(), what);
+	mismatches++;
+}
+
+template <typename F>
+double
+best_seconds(F&& f)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	double best = std::numeric_limits<double>::max();
+	for (int run = 0; run < bench_runs; run++) {
+		const auto start = Clock::now();
+		std::invoke(f);
+		const std::chrono::duration<double> took = Clock::now() - start;
+		best = std::min(best, took.count());
+	}
+	return best;
+}
+
+void
+report(const std::string& name, const double seconds, const double items, const char* unit)
+{
+	std::printf("%-48s %10.3f ms %10.3f M%s/s\n",
+				name.c_str(), seconds * 1e3, items / seconds * 1e-6, unit);
+}
+
+std::string
+extent_name(const CanvasExtent extent)
+{
+	return std::to_string(extent.width) + "x" + std::to_string(extent.height);
+}
+
+template <PixelFormat Format>
+bool
+same_pixels(const Canvas<Format>& lhs, const Canvas<Format>& rhs)
+{
+	return lhs.extent.width == rhs.extent.width
+		&& lhs.extent.height == rhs.extent.height
+		&& std::memcmp(lhs.pixels.data(), rhs.pixels.data(), lhs.memory_size()) == 0;
+}
+
+/**
+ * draw_rectangle as it was before the clipped span fills, with a bounds
+ * checked at() for every pixel, column by column.
+ */
+Canvas8bitRGBA
+draw_rectangle_per_pixel(const Pixel8bitRGBA color,
+						 const CanvasOffset offset,
+						 const CanvasExtent extent,
+						 Canvas8bitRGBA&& canvas)
+{
+	for (uint32_t dw = 0; dw < extent.width; dw++) {
+		for (uint32_t dh = 0; dh < extent.height; dh++) {
+			auto accessor = canvas.at(offset.x + dw, offset.y + dh);
+			if (accessor.has_value())
+				accessor.value().get() = color;
+		}
+	}
+	return canvas;
+}
+
+/**
+ * A rectangle covering the canvas, past its right and bottom edge so the
+ * clipping is part of what is measured.
+ */
+void
+bench_rectangle(const CanvasExtent extent)
+{
+	const auto color = Pixel8bitRGBA{170, 0, 170, 255};
+	const auto offset = CanvasOffset{16, 16};
+	const auto size = CanvasExtent{extent.width, extent.height};
+	const double pixels = (extent.width - 16.0) * (extent.height - 16.0);
+	const std::string name = "rectangle " + extent_name(extent);
+
+	auto reference = create_canvas(Pixel8bitRGBA{0, 0, 0, 255}, extent);
+	const double per_pixel = best_seconds([&]
+	{
+		reference = draw_rectangle_per_pixel(color, offset, size, std::move(reference));
+	});
+	report(name + " per pixel at()", per_pixel, pixels, "px");
+
+	auto spans = create_canvas(Pixel8bitRGBA{0, 0, 0, 255}, extent);
+	const double span = best_seconds([&]
+	{
+		const auto clipped = clip_rectangle(offset, size, spans.extent);
+		fill_rectangle(subview(as_view(spans), *clipped), color);
+	});
+	report(name + " fill_span", span, pixels, "px");
+
+	auto banded = create_canvas(Pixel8bitRGBA{0, 0, 0, 255}, extent);
+	const double pooled = best_seconds([&]
+	{
+		banded = std::move(banded) | draw_rectangle(color, offset, size);
+	});
+	report(name + " draw_rectangle (thread pool)", pooled, pixels, "px");
+
+	if (!same_pixels(reference, spans) || !same_pixels(reference, banded))
+		report_mismatch(name, "fill_span output differs from the per pixel path");
+}
+
+/**
+ * The composition main.cpp draws its texture with, run eagerly op by op
+ * and deferred into tile binned commands.
+ */
+void
+bench_composition(const CanvasExtent extent)
+{
+	const auto purple = Pixel8bitRGBA{170, 0, 170, 255};
+	const auto yellow = Pixel8bitRGBA{170, 170, 0, 255};
+	const double pixels = static_cast<double>(extent.width) * extent.height;
+	const std::string name = "composition " + extent_name(extent);
+
+	auto eager = create_canvas(purple, extent);
+	const double eager_seconds = best_seconds([&]
+	{
+		eager = std::move(eager)
+			| draw_checkerboard(yellow, 100)
+			| draw_coordinate_system(CanvasExtent{20, 400});
+	});
+	report(name + " eager", eager_seconds, pixels, "px");
+
+	auto deferred = create_canvas(purple, extent);
+	const double deferred_seconds = best_seconds([&]
+	{
+		deferred = std::move(deferred)
+			| defer_drawing
+			| draw_checkerboard(yellow, 100)
+			| draw_coordinate_system(CanvasExtent{20, 400})
+			| materialize;
+	});
+	report(name + " deferred", deferred_seconds, pixels, "px");
+
+	if (!same_pixels(eager, deferred))
+		report_mismatch(name, "deferred output differs from the eager one");
+}
+
+const char*
+blend_mode_name(const BlendMode mode)
+{
+	switch (mode) {
+	case BlendMode::SourceOver: return "source over";
+	case BlendMode::Additive: return "additive";
+	case BlendMode::Multiply: return "multiply";
+	}
+	return "unknown";
+}
+
+/**
+ * Premultiplied pixels with every alpha from transparent to opaque, so
+ * neither path gets to skip work.
+ */
+Canvas8bitRGBA
+create_blend_source(const CanvasExtent extent)
+{
+	auto canvas = create_canvas(Pixel8bitRGBA{0, 0, 0, 0}, extent);
+	for (size_t i = 0; i < size_t{extent.width} * extent.height; i++) {
+		const uint8_t alpha = static_cast<uint8_t>(i * 7);
+		canvas.pixels[i] = premultiply(Pixel8bitRGBA{static_cast<uint8_t>(i),
+													 static_cast<uint8_t>(i >> 3),
+													 static_cast<uint8_t>(i * 13),
+													 alpha});
+	}
+	return canvas;
+}
+
+/**
+ * Blending a whole canvas onto another through the SIMD span kernel and
+ * through the scalar reference it has to match bit for bit.
+ */
+void
+bench_blend(const CanvasExtent extent)
+{
+	const size_t count = size_t{extent.width} * extent.height;
+	const auto src = create_blend_source(extent);
+
+	for (const auto mode : {BlendMode::SourceOver, BlendMode::Additive, BlendMode::Multiply}) {
+		const std::string name = std::string("blend ") + blend_mode_name(mode)
+			+ " " + extent_name(extent);
+
+		auto scalar = create_canvas(Pixel8bitRGBA{40, 80, 120, 255}, extent);
+		const double scalar_seconds = best_seconds([&]
+		{
+			blend_span_scalar(mode, src.pixels.data(), scalar.pixels.data(), count);
+		});
+		report(name + " scalar", scalar_seconds, count, "px");
+
+		auto simd = create_canvas(Pixel8bitRGBA{40, 80, 120, 255}, extent);
+		const double simd_seconds = best_seconds([&]
+		{
+			blend_span(mode, src.pixels.data(), simd.pixels.data(), count);
+		});
+		report(name + " simd", simd_seconds, count, "px");
+
+		if (!same_pixels(scalar, simd))
+			report_mismatch(name, "simd output differs from the scalar reference");
+	}
+}
+
+/**
+ * Time a conversion kernel against its scalar reference on the same
+ * input, and check that both write the same output.
+ */
+template <typename Dst>
+void
+bench_conversion(const std::string& name,
+				 void (*scalar)(const uint8_t*, Dst*, size_t) noexcept,
+				 void (*dispatched)(const uint8_t*, Dst*, size_t) noexcept,
+				 const std::vector<uint8_t>& src,
+				 const size_t count,
+				 const size_t dst_channels)
+{
+	std::vector<Dst> reference(count * dst_channels);
+	const double scalar_seconds = best_seconds([&]
+	{
+		scalar(src.data(), reference.data(), count);
+	});
+	report(name + " scalar", scalar_seconds, count, "px");
+
+	std::vector<Dst> converted(count * dst_channels);
+	const double dispatched_seconds = best_seconds([&]
+	{
+		dispatched(src.data(), converted.data(), count);
+	});
+	report(name + " dispatched", dispatched_seconds, count, "px");
+
+	if (reference != converted)
+		report_mismatch(name, "dispatched output differs from the scalar reference");
+}
+
+/**
+ * The runtime dispatched bitmap conversions against their scalar
+ * references, on one 4K image worth of pixels.
+ */
+void
+bench_conversions(const CanvasExtent extent)
+{
+	const size_t count = size_t{extent.width} * extent.height;
+	std::vector<uint8_t> src(count * 4);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = static_cast<uint8_t>(i * 2654435761u >> 13);
+
+	const auto& kernels = bitmap_conversion_kernels();
+	const std::string size = " " + extent_name(extent);
+	bench_conversion("expand rgb to rgba" + size, expand_rgb_to_rgba_scalar,
+					 kernels.expand_rgb_to_rgba, src, count, 4);
+	bench_conversion("swizzle rgba bgra" + size, swizzle_rgba_bgra_scalar,
+					 kernels.swizzle_rgba_bgra, src, count, 4);
+	bench_conversion("srgb to linear" + size, srgb_to_linear_scalar,
+					 kernels.srgb_to_linear, src, count, 4);
+	bench_conversion("linear to srgb" + size, linear_to_srgb_scalar,
+					 kernels.linear_to_srgb, src, count, 4);
+	bench_conversion("rgba8 to rgba16f" + size, rgba8_to_rgba16f_scalar,
+					 kernels.rgba8_to_rgba16f, src, count, 4);
+}
+
+/*reads bit fields out of a 128bit block, least significant bit first*/
+struct BlockBitReader
+{
+	const uint8_t* in;
+	uint32_t position{0};
+
+	uint32_t get(const uint32_t bits) noexcept
+	{
+		uint32_t value = 0;
+		for (uint32_t i = 0; i < bits; i++, position++)
+			value |= ((in[position / 8] >> (position % 8)) & 1u) << i;
+		return value;
+	}
+};
+
+uint8_t
+interpolate(const uint32_t e0, const uint32_t e1, const uint32_t weight, const uint32_t steps)
+{
+	return static_cast<uint8_t>(((steps - weight) * e0 + weight * e1 + steps / 2) / steps);
+}
+
+/*BC1 colors, as a sampler decodes them*/
+void
+decode_bc1_block(const uint8_t* in, std::array<Pixel8bitRGBA, 16>& out)
+{
+	const uint16_t c0 = static_cast<uint16_t>(in[0] | (in[1] << 8));
+	const uint16_t c1 = static_cast<uint16_t>(in[2] | (in[3] << 8));
+	const BlockColor e0 = unpack_rgb565(c0);
+	const BlockColor e1 = unpack_rgb565(c1);
+
+	std::array<Pixel8bitRGBA, 4> palette{};
+	for (size_t c = 0; c < 3; c++) {
+		const auto a = static_cast<uint32_t>(e0[c]);
+		const auto b = static_cast<uint32_t>(e1[c]);
+		uint8_t* channels[4] = {&palette[0].r, &palette[1].r, &palette[2].r, &palette[3].r};
+		channels[0][c] = static_cast<uint8_t>(a);
+		channels[1][c] = static_cast<uint8_t>(b);
+		channels[2][c] = c0 > c1 ? interpolate(a, b, 1, 3) : interpolate(a, b, 1, 2);
+		channels[3][c] = c0 > c1 ? interpolate(a, b, 2, 3) : 0;
+	}
+	for (size_t i = 0; i < 4; i++)
+		palette[i].a = c0 <= c1 && i == 3 ? 0 : 255;
+
+	const uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | (uint32_t{in[7]} << 24);
+	for (size_t i = 0; i < 16; i++)
+		out[i] = palette[(indices >> (2 * i)) & 3];
+}
+
+void
+decode_bc3_block(const uint8_t* in, std::array<Pixel8bitRGBA, 16>& out)
+{
+	decode_bc1_block(in + 8, out);
+
+	const uint32_t a0 = in[0];
+	const uint32_t a1 = in[1];
+	std::array<uint8_t, 8> palette{static_cast<uint8_t>(a0), static_cast<uint8_t>(a1)};
+	for (uint32_t i = 2; i < 8; i++)
+		palette[i] = a0 > a1 ? interpolate(a0, a1, i - 1, 7)
+			: i < 6 ? interpolate(a0, a1, i - 1, 5) : (i == 6 ? 0 : 255);
+
+	uint64_t indices = 0;
+	for (size_t i = 0; i < 6; i++)
+		indices |= uint64_t{in[2 + i]} << (8 * i);
+	for (size_t i = 0; i < 16; i++)
+		out[i].a = palette[(indices >> (3 * i)) & 7];
+}
+
+/*BC7 mode 6 only, which is all the encoder writes*/
+void
+decode_bc7_block(const uint8_t* in, std::array<Pixel8bitRGBA, 16>& out)
+{
+	constexpr uint32_t weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+	BlockBitReader reader{in};
+	if (reader.get(7) != 1u << 6) {
+		out.fill(Pixel8bitRGBA{0, 0, 0, 0});
+		return;
+	}
+
+	uint32_t e0[4], e1[4];
+	for (size_t c = 0; c < 4; c++) {
+		e0[c] = reader.get(7) << 1;
+		e1[c] = reader.get(7) << 1;
+	}
+	const uint32_t p0 = reader.get(1);
+	const uint32_t p1 = reader.get(1);
+	for (size_t c = 0; c < 4; c++) {
+		e0[c] |= p0;
+		e1[c] |= p1;
+	}
+
+	for (size_t i = 0; i < 16; i++) {
+		const uint32_t w = weights[reader.get(i == 0 ? 3 : 4)];
+		uint8_t channels[4];
+		for (size_t c = 0; c < 4; c++)
+			channels[c] = static_cast<uint8_t>(((64 - w) * e0[c] + w * e1[c] + 32) >> 6);
+		out[i] = Pixel8bitRGBA{channels[0], channels[1], channels[2], channels[3]};
+	}
+}
+
+/**
+ * Peak signal to noise ratio of the decoded blocks against the source,
+ * over the color channels only for BC1.
+ */
+double
+block_compression_psnr(const Canvas8bitRGBA& source, const CompressedBitmap2D& compressed)
+{
+	const size_t block_bytes = BitmapPixelFormatBytesPerBlock(compressed.format);
+	const uint32_t blocks_x = (source.extent.width + 3) / 4;
+	const size_t channels = compressed.format == BitmapPixelFormat::BC1 ? 3 : 4;
+
+	double squared_error = 0.0;
+	std::array<Pixel8bitRGBA, 16> decoded{};
+	for (uint32_t y = 0; y < source.extent.height; y += 4) {
+		for (uint32_t x = 0; x < source.extent.width; x += 4) {
+			const uint8_t* block = compressed.blocks.data()
+				+ (size_t{y / 4} * blocks_x + x / 4) * block_bytes;
+			switch (compressed.format) {
+			case BitmapPixelFormat::BC1: decode_bc1_block(block, decoded); break;
+			case BitmapPixelFormat::BC3: decode_bc3_block(block, decoded); break;
+			default: decode_bc7_block(block, decoded); break;
+			}
+			for (uint32_t i = 0; i < 16; i++) {
+				const uint32_t px = x + i % 4;
+				const uint32_t py = y + i / 4;
+				if (px >= source.extent.width || py >= source.extent.height)
+					continue;
+				const auto& expected = source.pixels[size_t{py} * source.extent.width + px];
+				const uint8_t* lhs = &expected.r;
+				const uint8_t* rhs = &decoded[i].r;
+				for (size_t c = 0; c < channels; c++) {
+					const double error = static_cast<double>(lhs[c]) - rhs[c];
+					squared_error += error * error;
+				}
+			}
+		}
+	}
+	const double samples = static_cast<double>(source.extent.width) * source.extent.height * channels;
+	const double mse = squared_error / samples;
+	return mse == 0.0 ? std::numeric_limits<double>::infinity()
+		: 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+/**
+ * Smooth gradients with a hard edged pattern and noise on top, and an
+ * alpha ramp, which is closer to real textures than flat colors.
+ */
+Canvas8bitRGBA
+create_compression_source(const CanvasExtent extent)
+{
+	auto canvas = create_canvas(Pixel8bitRGBA{0, 0, 0, 255}, extent);
+	uint32_t noise = 12345;
+	for (uint32_t y = 0; y < extent.height; y++) {
+		for (uint32_t x = 0; x < extent.width; x++) {
+			noise = noise * 1664525u + 1013904223u;
+			const int jitter = static_cast<int>(noise >> 28) - 8;
+			const bool edge = ((x / 37) + (y / 23)) % 2 == 0;
+			const auto channel = [&] (const int value)
+			{
+				return static_cast<uint8_t>(std::clamp(value + jitter, 0, 255));
+			};
+			canvas.pixels[size_t{y} * extent.width + x] = Pixel8bitRGBA{
+				channel(static_cast<int>(x * 255 / extent.width)),
+				channel(edge ? 200 : 60),
+				channel(static_cast<int>(y * 255 / extent.height)),
+				static_cast<uint8_t>((x + y) * 255 / (extent.width + extent.height))};
+		}
+	}
+	return canvas;
+}
+
+void
+bench_block_compression(const CanvasExtent extent)
+{
+	const auto source = create_compression_source(extent);
+	const double pixels = static_cast<double>(extent.width) * extent.height;
+
+	const std::pair<BitmapPixelFormat, const char*> formats[] = {
+		{BitmapPixelFormat::BC1, "bc1"},
+		{BitmapPixelFormat::BC3, "bc3"},
+		{BitmapPixelFormat::BC7, "bc7"},
+	};
+	for (const auto& [format, format_name] : formats) {
+		const std::string name = std::string("encode ") + format_name + " " + extent_name(extent);
+		CompressedBitmap2D compressed{};
+		const double seconds = best_seconds([&]
+		{
+			compressed = compress_bitmap(source, format);
+		});
+		report(name, seconds, pixels, "px");
+		std::printf("%-48s %10.2f dB psnr\n", name.c_str(), block_compression_psnr(source, compressed));
+	}
+}
+
+/**
+ * Small primitives scattered over the canvas, typical of UI and debug
+ * drawing, counted as primitives per second.
+ */
+void
+bench_primitives(const CanvasExtent extent)
+{
+	constexpr size_t primitive_count = 10000;
+	std::vector<CanvasPoint> points(primitive_count * 3);
+	uint32_t random = 12345;
+	const auto next = [&] (const float range)
+	{
+		random = random * 1664525u + 1013904223u;
+		return static_cast<float>(random >> 8) / static_cast<float>(1u << 24) * range;
+	};
+	for (size_t i = 0; i < primitive_count; i++) {
+		const CanvasPoint origin{next(static_cast<float>(extent.width)),
+			                     next(static_cast<float>(extent.height))};
+		points[i * 3] = origin;
+		points[i * 3 + 1] = CanvasPoint{origin.x + next(64.0f) - 32.0f, origin.y + next(64.0f) - 32.0f};
+		points[i * 3 + 2] = CanvasPoint{origin.x + next(64.0f) - 32.0f, origin.y + next(64.0f) - 32.0f};
+	}
+
+	const auto color = Pixel8bitRGBA{0, 170, 170, 255};
+	auto canvas = create_canvas(Pixel8bitRGBA{0, 0, 0, 255}, extent);
+	const auto view = as_view(canvas);
+
+	const std::pair<CanvasAntialiasing, const char*> modes[] = {
+		{CanvasAntialiasing::None, "aliased"},
+		{CanvasAntialiasing::Coverage, "antialiased"},
+	};
+	for (const auto& [antialiasing, mode_name] : modes) {
+		const std::string suffix = std::string(" ") + mode_name + " " + extent_name(extent);
+
+		const double lines = best_seconds([&]
+		{
+			for (size_t i = 0; i < primitive_count; i++)
+				view | draw_line(color, points[i * 3], points[i * 3 + 1], 1.0f, antialiasing);
+		});
+		report("line 1px" + suffix, lines, primitive_count, "prim");
+
+		const double triangles = best_seconds([&]
+		{
+			for (size_t i = 0; i < primitive_count; i++)
+				view | draw_triangle(color, points[i * 3], points[i * 3 + 1], points[i * 3 + 2],
+									 antialiasing);
+		});
+		report("triangle" + suffix, triangles, primitive_count, "prim");
+
+		const double circles = best_seconds([&]
+		{
+			for (size_t i = 0; i < primitive_count; i++)
+				view | fill_circle(color, points[i * 3], 16.0f, antialiasing);
+		});
+		report("circle r16" + suffix, circles, primitive_count, "prim");
+	}
+}
+
+int main()
+{
+	for (const auto extent : {bench_1080p, bench_4k})
+		bench_rectangle(extent);
+	for (const auto extent : {bench_1080p, bench_4k})
+		bench_composition(extent);
+	for (const auto extent : {bench_1080p, bench_4k})
+		bench_blend(extent);
+	bench_conversions(bench_4k);
+	bench_block_compression(bench_1080p);
+	bench_primitives(bench_1080p);
+	return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Bitmap.hpp"
+
+/**
+ * Decoding an image file through stbi_load, which reads it with buffered
+ * stdio, against mapping it and decoding with stbi_load_from_memory.
+ * Warm runs read the file from the page cache. Cold runs drop it from the
+ * page cache first, so the file is read from the disk again.
+ *
+ *   loader_bench [image...]
+ */
+
+constexpr int bench_runs = 7;
+
+/*the pages of a file that nothing maps are dropped from the page cache*/
+bool
+evict_from_page_cache(const std::filesystem::path& path)
+{
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	const int result = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+	return result == 0;
+}
+
+/*fastest of the runs, a cold run evicts the file outside of the timing*/
+template <typename F>
+double
+best_seconds(const std::filesystem::path& path, const bool cold, F&& load)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	double best = std::numeric_limits<double>::max();
+	for (int run = 0; run < bench_runs; run++) {
+		if (cold)
+			(void)evict_from_page_cache(path);
+		const auto start = Clock::now();
+		const bool loaded = std::invoke(load);
+		const std::chrono::duration<double> took = Clock::now() - start;
+		if (!loaded)
+			return -1.0;
+		best = std::min(best, took.count());
+	}
+	return best;
+}
+
+void
+report(const std::string& name, const double seconds, const double megabytes)
+{
+	if (seconds < 0.0) {
+		std::printf("%-48s failed to load\n", name.c_str());
+		return;
+	}
+	std::printf("%-48s %10.3f ms %10.1f MB/s\n", name.c_str(), seconds * 1e3, megabytes / seconds);
+}
+
+bool
+load_with_stdio(const std::filesystem::path& path)
+{
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (pixels == nullptr)
+		return false;
+	stbi_image_free(pixels);
+	return true;
+}
+
+bool
+load_with_mapping(const std::filesystem::path& path)
+{
+	const auto mapped = map_file(path);
+	if (!std::holds_alternative<MappedFile>(mapped))
+		return false;
+	const MappedFile& file = std::get<MappedFile>(mapped);
+	if (file.size() > static_cast<size_t>(std::numeric_limits<int>::max()))
+		return false;
+
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load_from_memory(file.data(),
+											static_cast<int>(file.size()),
+											&width,
+											&height,
+											&channels,
+											STBI_rgb_alpha);
+	if (pixels == nullptr)
+		return false;
+	stbi_image_free(pixels);
+	return true;
+}
+
+void
+bench_loaders(const std::filesystem::path& path)
+{
+	std::error_code error;
+	const auto size = std::filesystem::file_size(path, error);
+	if (error) {
+		std::printf("%s: %s\n", path.c_str(), error.message().c_str());
+		return;
+	}
+	if (!evict_from_page_cache(path))
+		std::printf("%s: could not evict from the page cache, cold runs are warm\n", path.c_str());
+
+	const double megabytes = static_cast<double>(size) / (1024.0 * 1024.0);
+	const std::string name = path.filename().string();
+	for (const bool cold : {false, true}) {
+		const std::string cache = cold ? " cold" : " warm";
+		report(name + cache + " stbi_load",
+			   best_seconds(path, cold, [&] () { return load_with_stdio(path); }),
+			   megabytes);
+		report(name + cache + " map_file + stbi_load_from_memory",
+			   best_seconds(path, cold, [&] () { return load_with_mapping(path); }),
+			   megabytes);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::filesystem::path> images{};
+	for (int i = 1; i < argc; i++)
+		images.emplace_back(argv[i]);
+	if (images.empty())
+		images.emplace_back("../lulu.jpg");
+
+	for (const auto& image: images)
+		bench_loaders(image);
+	return 0;
+}
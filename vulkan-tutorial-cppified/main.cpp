@@ -8,10 +8,13 @@
 
 #include "VulkanRenderer.hpp"
 #include "SimpleRenderBlitPass.hpp"
+#include "TextureStreamer.hpp"
 //#include "GeometryPass.hpp"
 
 #include "Bitmap.hpp"
+#include "BitmapCache.hpp"
 #include "Canvas.hpp"
+#include "CanvasDisplayList.hpp"
 
 
 template <typename F, typename... Args>
@@ -31,56 +34,31 @@ int main()
 	const auto yellow = Pixel8bitRGBA{170, 170, 0, 255};
 
 	PresentationContext presentor(2);
-	Texture2D blit_texture;
 		
-	auto loaded_lulu = load_bitmap("../lulu.jpg", BitmapPixelFormat::RGBA);
-	if (!std::holds_alternative<LoadedBitmap2D>(loaded_lulu))
+	/*decoded once, later runs map the cached pixels instead of decoding*/
+	const auto bitmap_cache = std::filesystem::temp_directory_path() / "vulkan-tutorial-cppified";
+	auto loaded_lulu = load_cached_bitmap(bitmap_cache, "../lulu.jpg", BitmapPixelFormat::RGBA);
+	if (!std::holds_alternative<MappedBitmap2D>(loaded_lulu))
 		throw std::runtime_error("Could not load bitmap image..");
 	
 	auto lulu_checkerboard 
-		= std::move(std::get<LoadedBitmap2D>(loaded_lulu))
-		| as_canvas
+		= copy_to_canvas(std::get<MappedBitmap2D>(loaded_lulu))
+		| defer_drawing
 		| draw_checkerboard(yellow, 100)
-		| draw_coordinate_system(CanvasExtent{20, 400});
+		| draw_coordinate_system(CanvasExtent{20, 400})
+		| materialize;
 	
-	blit_texture = copy_to_gpu(presentor.physical_device,
-							   presentor.device.get(),
-							   presentor.command_pool(),
-							   presentor.graphics_queue(),
-							   vk::MemoryPropertyFlagBits::eDeviceLocal,
-							   lulu_checkerboard);
-
-	/*transfer the draw texture to a transferSrc layout for blitting*/
-	with_buffer_submit(presentor.device.get(),
-					   presentor.command_pool(),
-					   presentor.graphics_queue(),
-					   [&] (vk::CommandBuffer& commandbuffer)
-					   {
-						   auto range = vk::ImageSubresourceRange{}
-							   .setAspectMask(vk::ImageAspectFlagBits::eColor)
-							   .setBaseMipLevel(0)
-							   .setLevelCount(1)
-							   .setBaseArrayLayer(0)
-							   .setLayerCount(1);
-	
-						   auto barrier = vk::ImageMemoryBarrier{}
-							   .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
-							   .setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
-							   .setImage(get_image(blit_texture))
-							   .setSubresourceRange(range)
-							   .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
-							   .setDstAccessMask(vk::AccessFlagBits::eTransferRead)
-							   .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
-							   .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-	
-						   commandbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
-														 vk::PipelineStageFlagBits::eTransfer,
-														 vk::DependencyFlags(),
-														 nullptr,
-														 nullptr,
-														 barrier);
-					   });
-	blit_texture.layout = vk::ImageLayout::eTransferSrcOptimal;
+	/*the draw texture is uploaded once the render pass first uses it, and
+	  left in a transferSrc layout for blitting*/
+	TextureStreamer streamer(presentor.physical_device,
+							 presentor.device.get(),
+							 presentor.upload_queue(),
+							 presentor.staging_ring(),
+							 texture_streamer_default_budget,
+							 vk::ImageLayout::eTransferSrcOptimal,
+							 2);
+	const StreamedTextureHandle lulu_texture =
+		streamer.add([&] () { return texture_upload_source(lulu_checkerboard); });
 
 	std::cout << "===========================================================\n"
 			  << " Creating Simple RenderBlit Pass\n"
@@ -93,12 +71,14 @@ int main()
 									   presentor.device.get(),
 									   presentor.command_pool(),
 									   presentor.graphics_queue(),
-									   std::move(blit_texture),
+									   Texture2D{},
 									   presentor.get_window_extent(),
 									   2,
 									   resources_root + "/triangle.vert.spv",
 									   resources_root + "/triangle.frag.spv"
 									   );
+	render_blit_pass.streamer = &streamer;
+	render_blit_pass.streamed_draw_texture = lulu_texture;
 	
 	/** ************************************************************************
 	 * Frame Loop
@@ -161,6 +141,7 @@ int main()
 				};
 			
 			presentor.with_presentation(frameGenerator);
+			streamer.end_frame();
 		});
 
 		//std::this_thread::sleep_for(std::chrono::milliseconds(1000));
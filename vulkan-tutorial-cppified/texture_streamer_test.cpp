@@ -0,0 +1,185 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "HeadlessContext.hpp"
+#include "TextureStreamer.hpp"
+
+/**
+ * TextureStreamer against a small budget on a headless device: four
+ * 64x64 textures with their mips share a budget of two and a quarter of
+ * them, as the device lays one out, so using two of them at a time has to
+ * drop levels of and evict the ones that are not used, and using those
+ * again has to restore them.
+ */
+
+int failures = 0;
+
+void
+check(const bool passed, const char* what)
+{
+	std::printf("%s: %s\n", passed ? "ok" : "FAILED", what);
+	if (!passed)
+		failures++;
+}
+
+/*every texture gets its own pattern, so a mixed up upload shows*/
+Canvas8bitRGBA
+create_test_canvas(const uint8_t seed)
+{
+	const auto extent = CanvasExtent{64, 64};
+	auto canvas = create_canvas(Pixel8bitRGBA{0, 0, 0, 255}, extent);
+	for (uint32_t y = 0; y < extent.height; y++)
+		for (uint32_t x = 0; x < extent.width; x++)
+			canvas.pixels[size_t{y} * extent.width + x] = Pixel8bitRGBA{static_cast<uint8_t>(x * 4),
+																		static_cast<uint8_t>(y * 4),
+																		seed,
+																		255};
+	return canvas;
+}
+
+/*the device memory of one mipmapped texture, created like the streamer does*/
+vk::DeviceSize
+texture_memory_size(HeadlessContext& context, const Canvas8bitRGBA& canvas)
+{
+	const auto source = texture_upload_source(canvas);
+	const uint32_t mip_levels = supports_linear_blit(context.physical_device, source.format)
+		? mip_level_count(canvas.extent)
+		: 1;
+	Texture2D texture = create_empty_general_texture(context.physical_device,
+													 context.device.get(),
+													 source.format,
+													 source.extent,
+													 vk::ImageTiling::eOptimal,
+													 vk::MemoryPropertyFlagBits::eDeviceLocal,
+													 mip_levels);
+	return context.device->getImageMemoryRequirements(get_image(texture)).size;
+}
+
+/*copy level 0 of a texture in TransferSrcOptimal back and compare it*/
+bool
+texture_matches(HeadlessContext& context, Texture2D& texture, const Canvas8bitRGBA& expected)
+{
+	if (texture.extent.width != expected.extent.width
+		|| texture.extent.height != expected.extent.height)
+		return false;
+
+	AllocatedMemory readback = allocate_memory(context.physical_device,
+											   context.device.get(),
+											   expected.memory_size(),
+											   vk::BufferUsageFlagBits::eTransferDst,
+											   vk::MemoryPropertyFlagBits::eHostVisible
+											   | vk::MemoryPropertyFlagBits::eHostCoherent);
+
+	with_buffer_submit(context.device.get(),
+					   context.command_pool(),
+					   context.graphics_queue(),
+					   [&] (vk::CommandBuffer& commandbuffer)
+					   {
+						   const auto region = vk::BufferImageCopy{}
+							   .setBufferOffset(0)
+							   .setImageSubresource(vk::ImageSubresourceLayers{}
+													.setAspectMask(vk::ImageAspectFlagBits::eColor)
+													.setMipLevel(0)
+													.setBaseArrayLayer(0)
+													.setLayerCount(1))
+							   .setImageExtent(texture.extent);
+						   commandbuffer.copyImageToBuffer(get_image(texture),
+														   vk::ImageLayout::eTransferSrcOptimal,
+														   readback.buffer.get(),
+														   region);
+
+						   const auto host_read = vk::MemoryBarrier{}
+							   .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+							   .setDstAccessMask(vk::AccessFlagBits::eHostRead);
+						   commandbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+														 vk::PipelineStageFlagBits::eHost,
+														 vk::DependencyFlags(),
+														 host_read,
+														 nullptr,
+														 nullptr);
+					   });
+
+	void* mapped = context.device->mapMemory(readback.memory.get(), 0, VK_WHOLE_SIZE, vk::MemoryMapFlags());
+	const bool same = std::memcmp(mapped, get_pixels(expected), expected.memory_size()) == 0;
+	context.device->unmapMemory(readback.memory.get());
+	return same;
+}
+
+int main()
+{
+	HeadlessContext context;
+
+	std::vector<Canvas8bitRGBA> canvases{};
+	for (uint8_t i = 0; i < 4; i++)
+		canvases.push_back(create_test_canvas(static_cast<uint8_t>(40 * i + 10)));
+
+	const vk::DeviceSize texture_size = texture_memory_size(context, canvases[0]);
+	const vk::DeviceSize budget = texture_size * 2 + texture_size / 4;
+	std::printf("budget %llu bytes for textures of %llu bytes\n",
+				static_cast<unsigned long long>(budget),
+				static_cast<unsigned long long>(texture_size));
+	TextureStreamer streamer(context.physical_device,
+							 context.device.get(),
+							 context.upload_queue(),
+							 context.staging_ring(),
+							 budget,
+							 vk::ImageLayout::eTransferSrcOptimal,
+							 2);
+
+	std::vector<StreamedTextureHandle> handles{};
+	for (const auto& canvas: canvases)
+		handles.push_back(streamer.add([&canvas] () { return texture_upload_source(canvas); }));
+
+	/*a frame uses its textures, then the device finishes it*/
+	const auto frame = [&] (std::initializer_list<size_t> used)
+	{
+		for (const size_t i: used)
+			(void)streamer.use(handles[i]);
+		context.device->waitIdle();
+		streamer.end_frame();
+	};
+
+	for (int i = 0; i < 4; i++)
+		frame({0, 1});
+	TextureStreamerStats stats = streamer.stats();
+	check(stats.resident_textures == 2, "the first two textures are resident");
+	check(stats.resident_bytes <= budget, "two textures fit the budget");
+	check(stats.evictions == 0 && stats.dropped_mips == 0, "nothing is evicted while it fits");
+
+	Texture2D* first = streamer.use(handles[0]);
+	check(first != nullptr && texture_matches(context, *first, canvases[0]),
+		  "the first texture reads back its pixels");
+	context.device->waitIdle();
+	streamer.end_frame();
+
+	for (int i = 0; i < 8; i++)
+		frame({2, 3});
+	stats = streamer.stats();
+	std::printf("resident %llu of %llu bytes, %u textures, %llu evictions, %llu dropped mips\n",
+				static_cast<unsigned long long>(stats.resident_bytes),
+				static_cast<unsigned long long>(stats.budget),
+				stats.resident_textures,
+				static_cast<unsigned long long>(stats.evictions),
+				static_cast<unsigned long long>(stats.dropped_mips));
+	check(stats.resident_bytes <= budget, "residency settles within the budget");
+	check(stats.dropped_mips > 0, "unused textures drop mip levels");
+	check(stats.evictions > 0, "unused textures are evicted once dropping is not enough");
+	check(stats.pending_uploads == 0, "no uploads are left pending");
+
+	for (int i = 0; i < 4; i++)
+		frame({0});
+	Texture2D* restored = streamer.use(handles[0]);
+	check(restored != nullptr && restored->extent.width == 64,
+		  "the first texture is restored in full once used again");
+	check(restored != nullptr && texture_matches(context, *restored, canvases[0]),
+		  "the restored texture reads back its pixels");
+	context.device->waitIdle();
+	streamer.end_frame();
+
+	stats = streamer.stats();
+	check(stats.resident_bytes <= budget, "residency stays within the budget after the restore");
+
+	context.device->waitIdle();
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <limits>
+#include <vector>
+
+#include "HeadlessContext.hpp"
+
+/**
+ * Per texture cost of uploading textures one submission at a time against
+ * copy_to_gpu_batched, on a real device without a window.
+ * Wall time includes waiting for the device, the thread time is what the
+ * uploading thread spent itself, so it leaves out drivers that execute on
+ * threads of their own, like lavapipe.
+ * A warm start of an image file is measured too, decoding it against
+ * mapping its decoded pixels from the bitmap cache, both with the upload.
+ *
+ *   upload_bench [texture side] [device index] [image]
+ */
+
+constexpr int bench_runs = 5;
+
+struct UploadTiming
+{
+	double wall{std::numeric_limits<double>::max()};
+	double thread{std::numeric_limits<double>::max()};
+};
+
+double
+thread_seconds()
+{
+	timespec now{};
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) * 1e-9;
+}
+
+/*fastest of the runs, the textures are destroyed outside of the timing*/
+template <typename F>
+UploadTiming
+time_uploads(F&& upload)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	UploadTiming best{};
+	for (int run = 0; run < bench_runs; run++) {
+		const auto start = Clock::now();
+		const double thread_start = thread_seconds();
+		std::vector<Texture2D> textures = upload();
+		const double thread_took = thread_seconds() - thread_start;
+		const std::chrono::duration<double> took = Clock::now() - start;
+		best.wall = std::min(best.wall, took.count());
+		best.thread = std::min(best.thread, thread_took);
+	}
+	return best;
+}
+
+void
+report(const char* name, const size_t count, const UploadTiming timing)
+{
+	std::printf("%-10s %6zu textures %10.2f us/texture wall %10.2f us/texture thread\n",
+				name, count, timing.wall * 1e6 / count, timing.thread * 1e6 / count);
+}
+
+void
+bench_warm_start(HeadlessContext& context, const std::filesystem::path& image)
+{
+	const auto memory = vk::MemoryPropertyFlagBits::eDeviceLocal;
+	const auto cache = std::filesystem::temp_directory_path() / "upload_bench";
+
+	/*the first load writes the entry, every timed one is a hit*/
+	if (!std::holds_alternative<MappedBitmap2D>(load_cached_bitmap(cache, image, BitmapPixelFormat::RGBA))) {
+		std::printf("could not load %s, skipping the warm start\n", image.c_str());
+		return;
+	}
+
+	const UploadTiming decoded = time_uploads([&]
+	{
+		std::vector<Texture2D> textures{};
+		auto loaded = load_bitmap(image, BitmapPixelFormat::RGBA);
+		textures.push_back(copy_to_gpu(context.physical_device,
+									   context.device.get(),
+									   context.upload_queue(),
+									   context.staging_ring(),
+									   memory,
+									   std::get<LoadedBitmap2D>(loaded)));
+		return textures;
+	});
+	report("decode", 1, decoded);
+
+	const UploadTiming cached = time_uploads([&]
+	{
+		std::vector<Texture2D> textures{};
+		auto loaded = load_cached_bitmap(cache, image, BitmapPixelFormat::RGBA);
+		textures.push_back(copy_to_gpu(context.physical_device,
+									   context.device.get(),
+									   context.upload_queue(),
+									   context.staging_ring(),
+									   memory,
+									   std::get<MappedBitmap2D>(loaded)));
+		return textures;
+	});
+	report("cache hit", 1, cached);
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t side = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 64;
+	const auto device_index = argc > 2
+		? std::optional<uint32_t>(static_cast<uint32_t>(std::atoi(argv[2])))
+		: std::nullopt;
+	const std::filesystem::path image = argc > 3 ? argv[3] : "../lulu.jpg";
+
+	HeadlessContext context(device_index);
+	const auto memory = vk::MemoryPropertyFlagBits::eDeviceLocal;
+
+	for (const size_t count : {size_t{1}, size_t{10}, size_t{1000}}) {
+		std::vector<Canvas8bitRGBA> canvases{};
+		std::vector<TextureUploadSource> sources{};
+		for (size_t i = 0; i < count; i++)
+			canvases.push_back(create_canvas(Pixel8bitRGBA{static_cast<uint8_t>(i), 0, 170, 255},
+											 CanvasExtent{side, side}));
+		for (const auto& canvas: canvases)
+			sources.push_back(texture_upload_source(canvas));
+
+		const UploadTiming single = time_uploads([&]
+		{
+			std::vector<Texture2D> textures{};
+			for (const auto& canvas: canvases)
+				textures.push_back(copy_to_gpu(context.physical_device,
+											   context.device.get(),
+											   context.upload_queue(),
+											   context.staging_ring(),
+											   memory,
+											   canvas));
+			return textures;
+		});
+		report("single", count, single);
+
+		const UploadTiming batched = time_uploads([&]
+		{
+			return copy_to_gpu_batched(context.physical_device,
+									   context.device.get(),
+									   context.upload_queue(),
+									   context.staging_ring(),
+									   memory,
+									   sources);
+		});
+		report("batched", count, batched);
+	}
+
+	bench_warm_start(context, image);
+
+	context.device->waitIdle();
+	return 0;
+}